@@ -0,0 +1,818 @@
+#include "compressor.h"
+#include "compressed_image_view.h"
+#include "domain_coder.h"
+#include "quadtree_coder.h"
+#include "image.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+using Clock = std::chrono::high_resolution_clock;
+
+enum class Texture
+{
+    Gradient,
+    Noise,
+    Stripes,
+    Blobs,
+};
+
+const char* GetTextureName(Texture texture)
+{
+    switch (texture)
+    {
+    case Texture::Gradient: return "gradient";
+    case Texture::Noise:    return "noise";
+    case Texture::Stripes:  return "stripes";
+    case Texture::Blobs:    return "blobs";
+    }
+    return "unknown";
+}
+
+struct BenchmarkOptions
+{
+    double minTime;             // minimum measurement time per benchmark (in seconds)
+    bool quick;                 // skip the most expensive cases
+    std::string outputPath;     // JSON results
+    std::string originalsPath;  // directory with bundled BMP files
+
+    BenchmarkOptions()
+        : minTime(0.25)
+        , quick(false)
+        , outputPath("benchmark_results.json")
+        , originalsPath("../Original/")
+    { }
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    std::string image;
+    uint32 imageSize;
+    uint32 rangeSize;       // 0 if not applicable
+    uint32 repetitions;
+    double seconds;         // per repetition
+    double pixels;          // processed pixels per repetition
+    double candidates;      // evaluated domain candidates per repetition
+};
+
+// deterministic pseudo random numbers generator (xorshift)
+class Random
+{
+public:
+    Random(uint32 seed)
+        : mState(seed ? seed : 1)
+    { }
+
+    uint32 Next()
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+        return mState;
+    }
+
+private:
+    uint32 mState;
+};
+
+uint8 GenerateTexel(Texture texture, uint32 x, uint32 y, uint32 size, Random& random)
+{
+    switch (texture)
+    {
+    case Texture::Gradient:
+        return (uint8)((x + y) * 255 / (2 * size - 2));
+    case Texture::Noise:
+        return (uint8)(random.Next() >> 24);
+    case Texture::Stripes:
+        return ((x / 4 + y / 8) & 1) ? 220 : 30;
+    case Texture::Blobs:
+    {
+        // sum of a few smooth waves, plus a bit of noise
+        const float fx = (float)x / (float)size * 6.2831853f;
+        const float fy = (float)y / (float)size * 6.2831853f;
+        const float v = 128.0f + 50.0f * sinf(3.0f * fx) * cosf(2.0f * fy) + 40.0f * sinf(5.0f * (fx + fy));
+        return (uint8)std::max<int32>(0, std::min<int32>(255, (int32)v + (int32)(random.Next() >> 29) - 4));
+    }
+    }
+    return 0;
+}
+
+Image CreateSyntheticImage(Texture texture, uint32 size)
+{
+    Random random(size * 31 + (uint32)texture);
+
+    Image image;
+    image.Resize(size, 1);
+    for (uint32 y = 0; y < size; ++y)
+    {
+        for (uint32 x = 0; x < size; ++x)
+        {
+            image.WritePixel(x, y, GenerateTexel(texture, x, y, size, random));
+        }
+    }
+    return image;
+}
+
+// RGB image built from three different textures
+Image CreateSyntheticColorImage(uint32 size)
+{
+    const Image r = CreateSyntheticImage(Texture::Blobs, size);
+    const Image g = CreateSyntheticImage(Texture::Gradient, size);
+    const Image b = CreateSyntheticImage(Texture::Stripes, size);
+
+    Image image;
+    image.Resize(size, 3);
+    for (uint32 y = 0; y < size; ++y)
+    {
+        for (uint32 x = 0; x < size; ++x)
+        {
+            image.WritePixel3(x, y, r.Sample(x, y), g.Sample(x, y), b.Sample(x, y));
+        }
+    }
+    return image;
+}
+
+// prevent the compiler from removing benchmarked code
+volatile uint32 gSink = 0;
+
+// consumes the streamed encoder output (see Compressor::CompressToSink)
+class CountingEncoderSink : public EncoderSink
+{
+public:
+    CountingEncoderSink()
+        : mNumFlags(0)
+        , mNumDomains(0)
+    { }
+
+    bool OnRootRange(const EncodedRootRange& rootRange) override
+    {
+        mNumFlags += rootRange.quadtreeCode->GetSize();
+        mNumDomains += rootRange.numDomains;
+        return true;
+    }
+
+    uint32 GetNumFlags() const
+    {
+        return mNumFlags;
+    }
+
+    uint32 GetNumDomains() const
+    {
+        return mNumDomains;
+    }
+
+private:
+    uint32 mNumFlags;
+    uint32 mNumDomains;
+};
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+class CompressorBenchmark
+{
+public:
+    CompressorBenchmark(const BenchmarkOptions& options)
+        : mOptions(options)
+    { }
+
+    void Run()
+    {
+        const uint32 syntheticSizes[] = { 64, 128, 256 };
+        const Texture textures[] = { Texture::Gradient, Texture::Noise, Texture::Stripes, Texture::Blobs };
+
+        for (const uint32 size : syntheticSizes)
+        {
+            for (const Texture texture : textures)
+            {
+                const std::string name = std::string(GetTextureName(texture)) + "_" + std::to_string(size);
+                const Image image = CreateSyntheticImage(texture, size);
+
+                RunImageKernels(name, image);
+                RunEncoderKernels(name, image);
+
+                if (size == 64 || (!mOptions.quick && size == 128))
+                {
+                    RunCodec(name, image);
+                }
+            }
+
+            const Image colorImage = CreateSyntheticColorImage(size);
+            RunColorConversion("color_" + std::to_string(size), colorImage);
+        }
+
+        const char* originals[] = { "lena_512.bmp", "city_1024.bmp" };
+        for (const char* fileName : originals)
+        {
+            RunOriginal(fileName);
+        }
+    }
+
+    bool SaveResults() const
+    {
+        std::ofstream file(mOptions.outputPath);
+        if (!file.good())
+        {
+            std::cout << "Failed to open benchmark results file '" << mOptions.outputPath << "'" << std::endl;
+            return false;
+        }
+
+        file << "{\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < mResults.size(); ++i)
+        {
+            const BenchmarkResult& r = mResults[i];
+            file << "    { \"name\": \"" << r.name << "\""
+                << ", \"image\": \"" << r.image << "\""
+                << ", \"image_size\": " << r.imageSize
+                << ", \"range_size\": " << r.rangeSize
+                << ", \"repetitions\": " << r.repetitions
+                << std::setprecision(9)
+                << ", \"time_sec\": " << r.seconds
+                << ", \"pixels_per_sec\": " << (r.pixels / r.seconds)
+                << ", \"candidates_per_sec\": " << (r.candidates / r.seconds)
+                << " }" << (i + 1 < mResults.size() ? "," : "") << "\n";
+        }
+        file << "  ]\n}\n";
+        return file.good();
+    }
+
+private:
+    // run the function repeatedly for at least 'minTime' seconds
+    // the function returns number of evaluated domain candidates (if applicable)
+    template<typename Func>
+    void Measure(const std::string& name, const std::string& image, uint32 imageSize, uint32 rangeSize,
+                 double pixels, const Func& func, uint32 maxRepetitions = 1000000)
+    {
+        uint32 repetitions = 0;
+        double elapsed = 0.0;
+        double candidates = 0.0;
+
+        const Clock::time_point start = Clock::now();
+        do
+        {
+            candidates += func();
+            repetitions++;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < mOptions.minTime && repetitions < maxRepetitions);
+
+        BenchmarkResult result;
+        result.name = name;
+        result.image = image;
+        result.imageSize = imageSize;
+        result.rangeSize = rangeSize;
+        result.repetitions = repetitions;
+        result.seconds = elapsed / (double)repetitions;
+        result.pixels = pixels;
+        result.candidates = candidates / (double)repetitions;
+        mResults.push_back(result);
+
+        std::cout << std::left << std::setw(22) << name << std::setw(18) << image << std::right
+            << " range=" << std::setw(3) << rangeSize
+            << std::setw(12) << std::setprecision(4) << (result.seconds * 1000.0) << " ms"
+            << std::setw(12) << std::setprecision(4) << (pixels / result.seconds * 1.0e-6) << " Mpx/s";
+        if (result.candidates > 0.0)
+        {
+            std::cout << std::setw(12) << std::setprecision(4) << (result.candidates / result.seconds * 1.0e-6) << " Mcand/s";
+        }
+        std::cout << std::endl;
+    }
+
+    static void PrepareCompressor(Compressor& compressor, const Image& image)
+    {
+        compressor.mSize = image.GetSize();
+        compressor.mSizeBits = image.GetSizeBits();
+        compressor.mSizeMask = image.GetSizeMask();
+    }
+
+    static CompressorSettings GetSettings()
+    {
+        CompressorSettings settings;
+        settings.minRangeSize = 4;
+        settings.maxRangeSize = 16;
+        settings.disableImportance = true;
+        return settings;
+    }
+
+    void RunImageKernels(const std::string& name, const Image& image)
+    {
+        const uint32 size = image.GetSize();
+        const double numPixels = (double)size * (double)size;
+
+        Measure("SampleDomain", name, size, 0, numPixels, [&]() -> double
+        {
+            uint32 sum = 0;
+            for (uint32 y = 0; y < size; y += 2)
+                for (uint32 x = 0; x < size; x += 2)
+                    sum += image.SampleDomain(x, y);
+            gSink += sum;
+            return 0.0;
+        });
+
+        Measure("Downsample", name, size, 0, numPixels, [&]() -> double
+        {
+            gSink += image.Downsample().GetSize();
+            return 0.0;
+        });
+
+        Measure("Upsample", name, size, 0, numPixels, [&]() -> double
+        {
+            gSink += image.Upsample().GetSize();
+            return 0.0;
+        });
+    }
+
+    void RunEncoderKernels(const std::string& name, const Image& image)
+    {
+        const uint32 size = image.GetSize();
+        const uint32 maxRangeSize = mOptions.quick ? 16 : 32;
+
+        Compressor compressor(GetSettings());
+        PrepareCompressor(compressor, image);
+
+        std::vector<uint8> rangeDataCache(maxRangeSize * maxRangeSize);
+        std::vector<uint8> domainDataCache(maxRangeSize * maxRangeSize);
+        EncoderThreadStats stats;
+        RangeContext rangeContext(image, rangeDataCache, domainDataCache, stats);
+        rangeContext.rx0 = size / 2;
+        rangeContext.ry0 = size / 2;
+
+        const uint32 maxDomainLocations = std::min<uint32>(size, 1 << DOMAIN_LOCATION_BITS);
+        const double candidatesPerSearch = (double)(maxDomainLocations * maxDomainLocations * DOMAIN_MAX_TRANSFORMS);
+
+        // number of candidates evaluated since the last call
+        uint64 lastCandidates = 0;
+        const auto getEvaluatedCandidates = [&]()
+        {
+            const uint64 evaluated = stats.candidatesEvaluated - lastCandidates;
+            lastCandidates = stats.candidatesEvaluated;
+            return (double)evaluated;
+        };
+
+        for (uint32 rangeSize = 4; rangeSize <= maxRangeSize; rangeSize *= 2)
+        {
+            const double rangePixels = (double)(rangeSize * rangeSize);
+
+            const uint32 numCandidates = 4096;
+            Measure("MatchDomain", name, size, rangeSize, numCandidates * rangePixels, [&]() -> double
+            {
+                DomainMatchParams params(rangeContext);
+                float scale, offset, cost = 0.0f;
+                for (uint32 i = 0; i < numCandidates; ++i)
+                {
+                    params.dx0 = (i * 7) & image.GetSizeMask();
+                    params.dy0 = (i * 13) & image.GetSizeMask();
+                    params.transform = (uint8)(i % DOMAIN_MAX_TRANSFORMS);
+                    cost += compressor.MatchDomain(params, (uint8)rangeSize, scale, offset);
+                }
+                gSink += (uint32)cost;
+                return (double)numCandidates;
+            });
+
+            Measure("DomainSearch", name, size, rangeSize, candidatesPerSearch * rangePixels, [&]() -> double
+            {
+                Domain domain;
+                gSink += (uint32)compressor.DomainSearch(rangeContext, (uint8)rangeSize, domain);
+                return getEvaluatedCandidates();
+            }, 3);
+        }
+
+        {
+            const CompressorSettings settings = GetSettings();
+            const double rootPixels = (double)(settings.maxRangeSize * settings.maxRangeSize);
+
+            Measure("CompressRootRange", name, size, settings.maxRangeSize, rootPixels, [&]() -> double
+            {
+                QuadtreeCode quadtreeCode;
+                std::vector<Domain> domains;
+                getEvaluatedCandidates();
+                gSink += compressor.CompressRootRange(rangeContext, quadtreeCode, domains);
+                return getEvaluatedCandidates();
+            }, 1);
+        }
+    }
+
+    void RunCodec(const std::string& name, const Image& image)
+    {
+        const uint32 size = image.GetSize();
+        const double numPixels = (double)size * (double)size;
+
+        Compressor compressor(GetSettings());
+        Measure("Compress", name, size, 0, numPixels, [&]() -> double
+        {
+            EncoderTelemetry telemetry;
+            compressor.Compress(image, &telemetry);
+            return (double)telemetry.totals.candidatesEvaluated;
+        }, 1);
+
+        // streamed encoding, the encoder output is not kept
+        Measure("CompressToSink", name, size, 0, numPixels, [&]() -> double
+        {
+            Compressor streamingCompressor(GetSettings());
+            CountingEncoderSink sink;
+            EncoderTelemetry telemetry;
+            streamingCompressor.CompressToSink(image, sink, &telemetry);
+            gSink += sink.GetNumFlags() + sink.GetNumDomains();
+            return (double)telemetry.totals.candidatesEvaluated;
+        }, 1);
+
+        RunDecoder(name, compressor, size);
+    }
+
+    void RunDecoder(const std::string& name, const Compressor& compressor, uint32 size)
+    {
+        const double numPixels = (double)size * (double)size;
+
+        // entropy coding of the domains (as stored in the compressed file)
+        std::vector<uint8> domainData;
+        bool predictedPositions = false;
+        Measure("EncodeDomains", name, size, 0, numPixels, [&]() -> double
+        {
+            domainData.clear();
+            compressor.EncodeDomains(domainData, predictedPositions);
+            gSink += (uint32)domainData.size();
+            return 0.0;
+        });
+        std::cout << "    " << compressor.mDomains.size() << " domains: " << domainData.size() << " bytes ("
+                  << 8.0 * (double)domainData.size() / (double)compressor.mDomains.size() << " bits per domain, raw "
+                  << 8 * sizeof(Domain) << (predictedPositions ? ", relative locations" : "") << ")" << std::endl;
+
+        std::vector<DomainPrediction> predictions;
+        if (predictedPositions)
+        {
+            DomainCoder::PredictLocations(compressor.mQuadtreeCode, size, compressor.mSettings.minRangeSize,
+                                          compressor.mSettings.maxRangeSize, predictions);
+        }
+
+        std::vector<Domain> decodedDomains;
+        Measure("DecodeDomains", name, size, 0, numPixels, [&]() -> double
+        {
+            DomainCoder::Decode(domainData.data(), domainData.size(), (uint32)compressor.mDomains.size(), predictions, decodedDomains);
+            gSink += (uint32)decodedDomains.size();
+            return 0.0;
+        });
+
+        // entropy coding of the quadtree split flags
+        const uint32 minRangeSize = compressor.mSettings.minRangeSize;
+        const uint32 maxRangeSize = compressor.mSettings.maxRangeSize;
+        std::vector<uint8> quadtreeData;
+        Measure("EncodeQuadtree", name, size, 0, numPixels, [&]() -> double
+        {
+            quadtreeData.clear();
+            QuadtreeCoder::Encode(compressor.mQuadtreeCode, size, minRangeSize, maxRangeSize, quadtreeData);
+            gSink += (uint32)quadtreeData.size();
+            return 0.0;
+        });
+        std::cout << "    " << compressor.mQuadtreeCode.GetSize() << " split flags: " << quadtreeData.size() << " bytes (raw "
+                  << (compressor.mQuadtreeCode.GetSize() + 7) / 8 << ")" << std::endl;
+
+        QuadtreeCode decodedQuadtree;
+        Measure("DecodeQuadtree", name, size, 0, numPixels, [&]() -> double
+        {
+            QuadtreeCoder::Decode(quadtreeData.data(), quadtreeData.size(), size, minRangeSize, maxRangeSize,
+                                  compressor.mQuadtreeCode.GetSize(), decodedQuadtree);
+            gSink += decodedQuadtree.GetSize();
+            return 0.0;
+        });
+
+        // loading of the compressed file (mapped and parsed in place)
+        const std::string compressedPath = mOptions.outputPath + ".dat";
+        if (compressor.Save(compressedPath))
+        {
+            Compressor loaded;
+            Measure("LoadCompressed", name, size, 0, numPixels, [&]() -> double
+            {
+                loaded.Load(compressedPath);
+                gSink += (uint32)loaded.mDomains.size();
+                return 0.0;
+            });
+            remove(compressedPath.c_str());
+        }
+
+        // raw layout - mapped and referenced in place, the decode plan is built from the mapping
+        const std::string rawPath = compressedPath + ".raw";
+        if (compressor.SaveRaw(rawPath))
+        {
+            Measure("OpenRawView", name, size, 0, numPixels, [&]() -> double
+            {
+                CompressedImageView view;
+                view.Open(rawPath);
+                gSink += view.GetDomains().GetSize();
+                return 0.0;
+            });
+
+            CompressedImageView view;
+            if (view.Open(rawPath))
+            {
+                Measure("ViewDecodePlan", name, size, 0, numPixels, [&]() -> double
+                {
+                    DecodePlan plan;
+                    view.BuildDecodePlan(plan);
+                    gSink += (uint32)plan.GetLeaves().size();
+                    return 0.0;
+                });
+            }
+            view.Close();
+            remove(rawPath.c_str());
+        }
+
+        Measure("BuildDecodePlan", name, size, 0, numPixels, [&]() -> double
+        {
+            DecodePlan plan;
+            plan.Build(compressor.mQuadtreeCode, compressor.mDomains, size,
+                       compressor.mSettings.minRangeSize, compressor.mSettings.maxRangeSize);
+            gSink += (uint32)plan.GetLeaves().size();
+            return 0.0;
+        });
+
+        // single IFS iteration
+        Image images[2];
+        images[0].Resize(size, 1);
+        images[1].Resize(size, 1);
+        const std::shared_ptr<const DecodePlan> plan = compressor.GetDecodePlan();
+
+        Measure("DecodeIteration", name, size, 0, numPixels, [&]() -> double
+        {
+            DecompressionDelta delta;
+            plan->Execute(images[0], images[1], delta);
+            std::swap(images[0], images[1]);
+            return 0.0;
+        });
+
+        // single IFS iteration without specialized SIMD kernels
+        DecodePlan scalarPlan;
+        scalarPlan.Build(compressor.mQuadtreeCode, compressor.mDomains, size,
+                         compressor.mSettings.minRangeSize, compressor.mSettings.maxRangeSize, false);
+        Measure("DecodeIterationScalar", name, size, 0, numPixels, [&]() -> double
+        {
+            DecompressionDelta delta;
+            scalarPlan.Execute(images[0], images[1], delta);
+            std::swap(images[0], images[1]);
+            return 0.0;
+        });
+
+        // all the iterations (no early termination)
+        DecompressionSettings fullSettings;
+        fullSettings.tolerance = 0.0f;
+        Measure("DecompressFull", name, size, 0, numPixels, [&]() -> double
+        {
+            Image output;
+            compressor.Decompress(output, fullSettings);
+            gSink += output.GetSize();
+            return 0.0;
+        });
+
+        DecompressionStats stats;
+        Measure("Decompress", name, size, 0, numPixels, [&]() -> double
+        {
+            Image output;
+            compressor.Decompress(output, DecompressionSettings(), &stats);
+            gSink += output.GetSize();
+            return 0.0;
+        });
+        std::cout << "    converged after " << stats.iterations << " iterations (initial image saved ~"
+                  << stats.iterationsSaved << ")" << std::endl;
+
+        // steady state of a decoding session - buffers are reused between the calls
+        Decoder decoder;
+        Measure("DecompressReuse", name, size, 0, numPixels, [&]() -> double
+        {
+            decoder.Decode(*plan);
+            gSink += decoder.GetImage().GetSize();
+            return 0.0;
+        });
+
+        // independent decoders sharing the plan
+        const uint32 numConcurrentDecoders = std::max<uint32>(2, std::thread::hardware_concurrency());
+        Measure("DecompressConcurrent", name, size, 0, numPixels * numConcurrentDecoders, [&]() -> double
+        {
+            std::vector<uint32> decodedSizes(numConcurrentDecoders);
+            std::vector<std::thread> threads;
+            for (uint32 i = 0; i < numConcurrentDecoders; ++i)
+            {
+                threads.emplace_back([&, i]()
+                {
+                    Decoder threadDecoder;
+                    threadDecoder.Decode(*plan);
+                    decodedSizes[i] = threadDecoder.GetImage().GetSize();
+                });
+            }
+            for (uint32 i = 0; i < numConcurrentDecoders; ++i)
+            {
+                threads[i].join();
+                gSink += decodedSizes[i];
+            }
+            return 0.0;
+        });
+
+        DecompressionSettings blackInitSettings;
+        blackInitSettings.init = DecompressionInit::Black;
+        Measure("DecompressBlackInit", name, size, 0, numPixels, [&]() -> double
+        {
+            Image output;
+            compressor.Decompress(output, blackInitSettings, &stats);
+            gSink += output.GetSize();
+            return 0.0;
+        });
+        std::cout << "    converged after " << stats.iterations << " iterations" << std::endl;
+
+        DecompressionSettings andersonSettings;
+        andersonSettings.solver = DecompressionSolver::Anderson;
+        Measure("DecompressAnderson", name, size, 0, numPixels, [&]() -> double
+        {
+            decoder.Decode(*plan, andersonSettings, &stats);
+            gSink += decoder.GetImage().GetSize();
+            return 0.0;
+        });
+        std::cout << "    converged after " << stats.iterations << " iterations" << std::endl;
+
+        DecompressionSettings parallelSettings;
+        parallelSettings.numThreads = 0;
+        Measure("DecompressParallel", name, size, 0, numPixels, [&]() -> double
+        {
+            Image output;
+            compressor.Decompress(output, parallelSettings);
+            gSink += output.GetSize();
+            return 0.0;
+        });
+
+        DecompressionSettings inPlaceSettings;
+        inPlaceSettings.inPlace = true;
+        Measure("DecompressInPlace", name, size, 0, numPixels, [&]() -> double
+        {
+            Image output;
+            compressor.Decompress(output, inPlaceSettings, &stats);
+            gSink += output.GetSize();
+            return 0.0;
+        });
+        std::cout << "    converged after " << stats.iterations << " iterations" << std::endl;
+
+        // small tile of a coarse (few iterations) preview
+        DecompressionSettings regionSettings;
+        regionSettings.maxIterations = 3;
+        const uint32 regionSize = std::max<uint32>(1, size / 8);
+        Measure("DecompressRegion", name, size, 0, (double)regionSize * (double)regionSize, [&]() -> double
+        {
+            Image output;
+            compressor.DecompressRegion(size / 2, size / 2, regionSize, regionSize, output, regionSettings, &stats);
+            gSink += output.GetSize();
+            return 0.0;
+        });
+        std::cout << "    decoded " << stats.decodedFraction * 100.0f << "% of the image" << std::endl;
+
+        DecompressionSettings thumbnailSettings;
+        thumbnailSettings.resolutionShift = -2;
+        Measure("DecompressThumbnail", name, size, 0, numPixels / 16.0, [&]() -> double
+        {
+            Image output;
+            compressor.Decompress(output, thumbnailSettings, &stats);
+            gSink += output.GetSize();
+            return 0.0;
+        });
+
+        DecompressionSettings upscaledSettings;
+        upscaledSettings.resolutionShift = 2;
+        Measure("DecompressUpscaled", name, size, 0, numPixels * 16.0, [&]() -> double
+        {
+            Image output;
+            compressor.Decompress(output, upscaledSettings, &stats);
+            gSink += output.GetSize();
+            return 0.0;
+        });
+    }
+
+    void RunColorConversion(const std::string& name, const Image& colorImage)
+    {
+        const uint32 size = colorImage.GetSize();
+        const double numPixels = (double)size * (double)size;
+
+        Image y, cb, cr;
+        Measure("ToYCbCr", name, size, 0, numPixels, [&]() -> double
+        {
+            colorImage.ToYCbCr(y, cb, cr);
+            return 0.0;
+        });
+
+        Image rgb;
+        Measure("FromYCbCr", name, size, 0, numPixels, [&]() -> double
+        {
+            rgb.FromYCbCr(y, cb, cr);
+            return 0.0;
+        });
+
+        // output stage with 4x subsampled chroma, written to BGRX buffer
+        const Image smallCb = cb.Downsample().Downsample();
+        const Image smallCr = cr.Downsample().Downsample();
+        std::vector<uint8> pixels(4 * size * size);
+        Measure("ConvertFromYCbCr", name, size, 0, numPixels, [&]() -> double
+        {
+            Image::ConvertFromYCbCr(y, smallCb, smallCr, pixels.data(), 4 * size, 4);
+            return 0.0;
+        });
+    }
+
+    void RunOriginal(const char* fileName)
+    {
+        const std::string path = mOptions.originalsPath + fileName;
+
+        Image y, cb, cr;
+        if (!Image::LoadYCbCr(path.c_str(), y, cb, cr))
+        {
+            std::cout << "Skipping '" << path << "'" << std::endl;
+            return;
+        }
+
+        const uint32 size = y.GetSize();
+        const double numPixels = (double)size * (double)size;
+
+        Measure("LoadYCbCr", fileName, size, 0, numPixels, [&]() -> double
+        {
+            Image::LoadYCbCr(path.c_str(), y, cb, cr);
+            return 0.0;
+        });
+
+        Image rgb;
+        Measure("FromYCbCr", fileName, size, 0, numPixels, [&]() -> double
+        {
+            rgb.FromYCbCr(y, cb, cr);
+            return 0.0;
+        });
+
+        Measure("ToYCbCr", fileName, size, 0, numPixels, [&]() -> double
+        {
+            rgb.ToYCbCr(y, cb, cr);
+            return 0.0;
+        });
+
+        RunImageKernels(fileName, y);
+
+        // full encode is too slow for full resolution, so the channels are downsampled
+        const uint32 encodedSize = mOptions.quick ? 32 : 128;
+        const char* channelNames[] = { "Y", "Cb", "Cr" };
+        Image* channels[] = { &y, &cb, &cr };
+        for (uint32 i = 0; i < 3; ++i)
+        {
+            Image channel = *channels[i];
+            while (channel.GetSize() > encodedSize)
+            {
+                channel = channel.Downsample();
+            }
+            RunCodec(std::string(fileName) + ":" + channelNames[i], channel);
+        }
+    }
+
+    BenchmarkOptions mOptions;
+    std::vector<BenchmarkResult> mResults;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+        {
+            options.quick = true;
+            options.minTime = 0.05;
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            options.outputPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--originals") == 0 && i + 1 < argc)
+        {
+            options.originalsPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+        {
+            options.minTime = atof(argv[++i]);
+        }
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--quick] [--output results.json] [--originals dir/] [--min-time seconds]" << std::endl;
+            return 1;
+        }
+    }
+
+    CompressorBenchmark benchmark(options);
+    benchmark.Run();
+    return benchmark.SaveResults() ? 0 : 2;
+}
@@ -0,0 +1,267 @@
+#include "bitmap.h"
+
+#include <iostream>
+#include <assert.h>
+#include <string.h>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+#define BITMAP_MAGIC                0x4D42  // "BM"
+#define BITMAP_FILE_HEADER_SIZE     14
+#define BITMAP_INFO_HEADER_SIZE     40
+#define BITMAP_HEADERS_SIZE         (BITMAP_FILE_HEADER_SIZE + BITMAP_INFO_HEADER_SIZE)
+#define BITMAP_COMPRESSION_RGB      0
+
+// larger pictures are rejected (keeps the row stride and the pixel data size in range)
+#define BITMAP_MAX_DIMENSION        (1 << 16)
+
+namespace {
+
+// all the BMP header fields are stored as little endian
+
+FORCE_INLINE uint16 ReadUint16(const uint8* data)
+{
+    return (uint16)((uint32)data[0] | ((uint32)data[1] << 8));
+}
+
+FORCE_INLINE uint32 ReadUint32(const uint8* data)
+{
+    return (uint32)data[0] | ((uint32)data[1] << 8) | ((uint32)data[2] << 16) | ((uint32)data[3] << 24);
+}
+
+FORCE_INLINE void WriteUint16(uint8* data, uint16 value)
+{
+    data[0] = (uint8)value;
+    data[1] = (uint8)(value >> 8);
+}
+
+FORCE_INLINE void WriteUint32(uint8* data, uint32 value)
+{
+    data[0] = (uint8)value;
+    data[1] = (uint8)(value >> 8);
+    data[2] = (uint8)(value >> 16);
+    data[3] = (uint8)(value >> 24);
+}
+
+// rows are padded to 4 bytes
+FORCE_INLINE uint64 CalculateRowStride(uint32 width, uint32 bytesPerPixel)
+{
+    return ((uint64)width * (uint64)bytesPerPixel + 3) & ~(uint64)3;
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+BitmapReader::BitmapReader()
+    : mPixels(nullptr)
+    , mWidth(0)
+    , mHeight(0)
+    , mBytesPerPixel(0)
+    , mRowStride(0)
+    , mTopDown(false)
+{ }
+
+bool BitmapReader::Open(const char* path)
+{
+    Close();
+
+    if (!mFile.Open(path))
+    {
+        return false;
+    }
+
+    const uint8* data = mFile.GetData();
+    const size_t size = mFile.GetSize();
+
+    if (size < BITMAP_HEADERS_SIZE || ReadUint16(data) != BITMAP_MAGIC)
+    {
+        std::cout << "Not a BMP file" << std::endl;
+        Close();
+        return false;
+    }
+
+    const uint32 dataOffset = ReadUint32(data + 10);
+
+    // BITMAPINFOHEADER or any of its extensions (V4, V5)
+    const uint8* info = data + BITMAP_FILE_HEADER_SIZE;
+    const uint32 infoSize = ReadUint32(info);
+    const int32 width = (int32)ReadUint32(info + 4);
+    const int32 height = (int32)ReadUint32(info + 8);
+    const uint16 planes = ReadUint16(info + 12);
+    const uint16 bitCount = ReadUint16(info + 14);
+    const uint32 compression = ReadUint32(info + 16);
+
+    if (infoSize < BITMAP_INFO_HEADER_SIZE || planes != 1 || compression != BITMAP_COMPRESSION_RGB ||
+        (bitCount != 24 && bitCount != 32))
+    {
+        std::cout << "Unsupported file format" << std::endl;
+        Close();
+        return false;
+    }
+
+    if (width <= 0 || width > BITMAP_MAX_DIMENSION || height == 0 || height < -BITMAP_MAX_DIMENSION || height > BITMAP_MAX_DIMENSION)
+    {
+        std::cout << "Invalid BMP dimensions" << std::endl;
+        Close();
+        return false;
+    }
+
+    mWidth = (uint32)width;
+    mHeight = (uint32)(height < 0 ? -height : height);
+    mTopDown = height < 0;
+    mBytesPerPixel = bitCount / 8;
+    mRowStride = (uint32)CalculateRowStride(mWidth, mBytesPerPixel);
+
+    const uint64 pixelsSize = (uint64)mRowStride * (uint64)mHeight;
+    if (dataOffset < BITMAP_FILE_HEADER_SIZE + (uint64)infoSize || dataOffset > size || (uint64)(size - dataOffset) < pixelsSize)
+    {
+        std::cout << "Truncated BMP file" << std::endl;
+        Close();
+        return false;
+    }
+
+    mPixels = data + dataOffset;
+    return true;
+}
+
+void BitmapReader::Close()
+{
+    mFile.Close();
+    mPixels = nullptr;
+    mWidth = 0;
+    mHeight = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+BitmapWriter::BitmapWriter()
+    : mFile(nullptr)
+    , mWidth(0)
+    , mHeight(0)
+    , mRowsWritten(0)
+{ }
+
+BitmapWriter::~BitmapWriter()
+{
+    if (mFile)
+    {
+        fclose(mFile);
+    }
+}
+
+bool BitmapWriter::Open(const std::string& name, uint32 width, uint32 height)
+{
+    if (mFile)
+    {
+        std::cout << "Bitmap file is already open" << std::endl;
+        return false;
+    }
+
+    // the file size must fit in the 32-bit header field
+    const uint64 rowStride = CalculateRowStride(width, 3);
+    if (width == 0 || width > BITMAP_MAX_DIMENSION || height == 0 || height > BITMAP_MAX_DIMENSION ||
+        rowStride * height > 0xFFFFFFFFull - BITMAP_HEADERS_SIZE)
+    {
+        std::cout << "Invalid bitmap dimensions" << std::endl;
+        return false;
+    }
+
+    const uint32 dataSize = (uint32)(rowStride * height);
+
+    uint8 header[BITMAP_HEADERS_SIZE];
+    memset(header, 0, sizeof(header));
+
+    // BITMAPFILEHEADER
+    WriteUint16(header + 0, BITMAP_MAGIC);
+    WriteUint32(header + 2, BITMAP_HEADERS_SIZE + dataSize);
+    WriteUint32(header + 10, BITMAP_HEADERS_SIZE);
+
+    // BITMAPINFOHEADER (bottom-up, 24 bits per pixel)
+    uint8* info = header + BITMAP_FILE_HEADER_SIZE;
+    WriteUint32(info + 0, BITMAP_INFO_HEADER_SIZE);
+    WriteUint32(info + 4, width);
+    WriteUint32(info + 8, height);
+    WriteUint16(info + 12, 1);
+    WriteUint16(info + 14, 24);
+    WriteUint32(info + 16, BITMAP_COMPRESSION_RGB);
+    WriteUint32(info + 20, dataSize);
+    WriteUint32(info + 24, 96);
+    WriteUint32(info + 28, 96);
+
+    mFile = fopen(name.c_str(), "wb");
+    if (!mFile)
+    {
+        std::cout << "Failed to open target image '" << name << "'" << std::endl;
+        return false;
+    }
+
+    if (fwrite(header, sizeof(header), 1, mFile) != 1)
+    {
+        std::cout << "Failed to write bitmap header" << std::endl;
+        fclose(mFile);
+        mFile = nullptr;
+        return false;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mRowsWritten = 0;
+    mRowBuffer.clear();
+    mRowBuffer.resize((size_t)rowStride, 0);
+    return true;
+}
+
+bool BitmapWriter::WriteRow(const uint8* data)
+{
+    memcpy(mRowBuffer.data(), data, 3 * mWidth);
+    return WriteRowBuffer();
+}
+
+bool BitmapWriter::WriteGrayscaleRow(const uint8* data)
+{
+    uint8* row = mRowBuffer.data();
+    for (uint32 i = 0; i < mWidth; ++i)
+    {
+        row[3 * i] = data[i];
+        row[3 * i + 1] = data[i];
+        row[3 * i + 2] = data[i];
+    }
+    return WriteRowBuffer();
+}
+
+bool BitmapWriter::WriteRowBuffer()
+{
+    assert(mFile);
+    assert(mRowsWritten < mHeight);
+
+    if (fwrite(mRowBuffer.data(), mRowBuffer.size(), 1, mFile) != 1)
+    {
+        std::cout << "Failed to write bitmap image data" << std::endl;
+        return false;
+    }
+
+    mRowsWritten++;
+    return true;
+}
+
+bool BitmapWriter::Close()
+{
+    if (!mFile)
+    {
+        return false;
+    }
+
+    const bool complete = mRowsWritten == mHeight;
+    const bool closed = fclose(mFile) == 0;
+    mFile = nullptr;
+
+    if (!complete || !closed)
+    {
+        std::cout << "Failed to finish bitmap file" << std::endl;
+        return false;
+    }
+
+    return true;
+}
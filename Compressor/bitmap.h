@@ -0,0 +1,92 @@
+#pragma once
+
+#include "common.h"
+#include "mapped_file.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+
+// Portable BMP reader (uncompressed 24 and 32 bits per pixel).
+// The file is memory mapped and pixels are accessed in place.
+// Rows are always counted from the bottom of the picture (as in bottom-up bitmaps),
+// regardless of the order in which they are stored in the file.
+class BitmapReader
+{
+public:
+    BitmapReader();
+
+    // map BMP file and parse its headers
+    bool Open(const char* path);
+
+    void Close();
+
+    uint32 GetWidth() const
+    {
+        return mWidth;
+    }
+
+    uint32 GetHeight() const
+    {
+        return mHeight;
+    }
+
+    // 3 (BGR) or 4 (BGRX)
+    uint32 GetBytesPerPixel() const
+    {
+        return mBytesPerPixel;
+    }
+
+    // get pixels of a single row (in file order, BGR or BGRX)
+    const uint8* GetRow(uint32 y) const
+    {
+        const uint32 fileRow = mTopDown ? (mHeight - 1 - y) : y;
+        return mPixels + (size_t)fileRow * (size_t)mRowStride;
+    }
+
+private:
+    MappedFile mFile;
+    const uint8* mPixels;
+    uint32 mWidth;
+    uint32 mHeight;
+    uint32 mBytesPerPixel;
+    uint32 mRowStride;  // including padding
+    bool mTopDown;
+};
+
+// Streaming 24-bit BMP writer. Rows must be written from the bottom of the picture.
+class BitmapWriter
+{
+public:
+    BitmapWriter();
+    ~BitmapWriter();
+
+    // create the file and write BMP headers
+    bool Open(const std::string& name, uint32 width, uint32 height);
+
+    // write row of 3-channel pixels
+    bool WriteRow(const uint8* data);
+
+    // write row of grayscale pixels (expanded to all the channels)
+    bool WriteGrayscaleRow(const uint8* data);
+
+    // row can be also filled in place (3 bytes per pixel) and written with WriteRowBuffer()
+    uint8* GetRowBuffer()
+    {
+        return mRowBuffer.data();
+    }
+
+    bool WriteRowBuffer();
+
+    // finish writing
+    bool Close();
+
+private:
+
+    FILE* mFile;
+    std::vector<uint8> mRowBuffer;  // single row, including padding
+    uint32 mWidth;
+    uint32 mHeight;
+    uint32 mRowsWritten;
+};
@@ -0,0 +1,163 @@
+#include "color_compressor.h"
+#include "container.h"
+#include "mapped_file.h"
+
+#include <iostream>
+#include <algorithm>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const ChannelType gChannelTypes[COLOR_NUM_CHANNELS] = { ChannelType::Luma, ChannelType::ChromaBlue, ChannelType::ChromaRed };
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+ColorCompressor::ColorCompressor(const CompressorSettings& lumaSettings, const CompressorSettings& chromaBlueSettings,
+                                 const CompressorSettings& chromaRedSettings)
+{
+    CompressorSettings settings[COLOR_NUM_CHANNELS] = { lumaSettings, chromaBlueSettings, chromaRedSettings };
+    settings[0].channelSubsampling = 0;
+
+    for (uint32 i = 0; i < COLOR_NUM_CHANNELS; ++i)
+    {
+        settings[i].channelType = gChannelTypes[i];
+        mChannels[i].reset(new Compressor(settings[i]));
+    }
+}
+
+bool ColorCompressor::Load(const std::string& name)
+{
+    // the file is parsed in place, decoded data does not refer to the mapping
+    MappedFile file;
+    if (!file.Open(name.c_str(), COMPRESSOR_MAPPED_FILE_MIN_SIZE))
+    {
+        return false;
+    }
+
+    std::vector<Compressor::ChannelChunks> channels;
+    if (!Compressor::ReadChannels(file.GetData(), file.GetSize(), channels))
+    {
+        return false;
+    }
+
+    if (channels.size() != COLOR_NUM_CHANNELS)
+    {
+        std::cout << "Compressed file contains " << channels.size() << " channel(s), expected " << COLOR_NUM_CHANNELS << std::endl;
+        return false;
+    }
+
+    // all the channels are decoded first, so an invalid file doesn't leave the channels mixed up
+    Compressor::LoadedChannel loaded[COLOR_NUM_CHANNELS];
+    for (uint32 i = 0; i < COLOR_NUM_CHANNELS; ++i)
+    {
+        if (!Compressor::ReadChannel(channels[i], COLOR_NUM_CHANNELS, loaded[i]))
+        {
+            return false;
+        }
+
+        if (loaded[i].parameters.channelType != gChannelTypes[i])
+        {
+            std::cout << "Corrupted file (unexpected channel type)" << std::endl;
+            return false;
+        }
+    }
+
+    for (uint32 i = 0; i < COLOR_NUM_CHANNELS; ++i)
+    {
+        mChannels[i]->ApplyLoadedChannel(loaded[i]);
+    }
+
+    return true;
+}
+
+bool ColorCompressor::Save(const std::string& name) const
+{
+    ContainerWriter container;
+    for (uint32 i = 0; i < COLOR_NUM_CHANNELS; ++i)
+    {
+        if (!mChannels[i]->WriteChannel(container, COLOR_NUM_CHANNELS))
+        {
+            return false;
+        }
+    }
+
+    return WriteFileData(name, container.Finish());
+}
+
+bool ColorCompressor::Compress(const Image& image, EncoderTelemetry* outTelemetry)
+{
+    Image y, cb, cr;
+    if (!image.ToYCbCr(y, cb, cr))
+    {
+        return false;
+    }
+
+    return Compress(y, cb, cr, outTelemetry);
+}
+
+bool ColorCompressor::Compress(const Image& y, const Image& cb, const Image& cr, EncoderTelemetry* outTelemetry)
+{
+    const Image* sources[COLOR_NUM_CHANNELS] = { &y, &cb, &cr };
+
+    for (uint32 i = 0; i < COLOR_NUM_CHANNELS; ++i)
+    {
+        if (sources[i]->GetSize() != y.GetSize())
+        {
+            std::cout << "Channel images must have the same size" << std::endl;
+            return false;
+        }
+
+        Image downsampled;
+        const Image* source = sources[i];
+        for (uint32 j = 0; j < mChannels[i]->GetSettings().channelSubsampling; ++j)
+        {
+            downsampled = source->Downsample();
+            source = &downsampled;
+        }
+
+        if (!mChannels[i]->Compress(*source, outTelemetry ? outTelemetry + i : nullptr))
+        {
+            std::cout << "Failed to compress channel " << i << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ColorCompressor::Decompress(Image& outImage, const DecompressionSettings& settings, DecompressionStats* outStats) const
+{
+    Image y, cb, cr;
+    if (!Decompress(y, cb, cr, settings, outStats))
+    {
+        return false;
+    }
+
+    return outImage.FromYCbCr(y, cb, cr);
+}
+
+bool ColorCompressor::Decompress(Image& outY, Image& outCb, Image& outCr, const DecompressionSettings& settings,
+                                 DecompressionStats* outStats) const
+{
+    Image* outputs[COLOR_NUM_CHANNELS] = { &outY, &outCb, &outCr };
+
+    for (uint32 i = 0; i < COLOR_NUM_CHANNELS; ++i)
+    {
+        // undo the subsampling while decoding, the rest is upsampled during color conversion
+        DecompressionSettings channelSettings = settings;
+        channelSettings.resolutionShift = std::min<int32>(DECODE_MAX_RESOLUTION_SHIFT,
+            settings.resolutionShift + (int32)mChannels[i]->GetSettings().channelSubsampling);
+
+        if (!mChannels[i]->Decompress(*outputs[i], channelSettings, outStats ? outStats + i : nullptr))
+        {
+            std::cout << "Failed to decompress channel " << i << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
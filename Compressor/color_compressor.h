@@ -0,0 +1,58 @@
+#pragma once
+
+#include "compressor.h"
+
+#include <memory>
+
+
+// luma and two chroma channels
+#define COLOR_NUM_CHANNELS 3
+
+/**
+* Compressor of color images.
+* The image is decomposed into Y, Cb and Cr channels, chroma channels are downsampled
+* (2^channelSubsampling times, see CompressorSettings) and every channel is compressed separately.
+* All the channels are stored in one file, as consecutive channel sections of the container (Y, Cb, Cr).
+*/
+class ColorCompressor
+{
+public:
+    // channel types are set automatically, luma is never subsampled
+    ColorCompressor(const CompressorSettings& lumaSettings = CompressorSettings(),
+                    const CompressorSettings& chromaBlueSettings = CompressorSettings(),
+                    const CompressorSettings& chromaRedSettings = CompressorSettings());
+
+    // load all the channels from a file
+    // NOTE: none of the channels is modified if the file can't be loaded
+    bool Load(const std::string& name);
+
+    // save all the channels to a single file
+    bool Save(const std::string& name) const;
+
+    // compress RGB image
+    // optionally, fills encoder telemetry of every channel (array of COLOR_NUM_CHANNELS elements)
+    bool Compress(const Image& image, EncoderTelemetry* outTelemetry = nullptr);
+
+    // compress full resolution YCbCr images (e.g. from Image::LoadYCbCr), chroma is downsampled here
+    bool Compress(const Image& y, const Image& cb, const Image& cr, EncoderTelemetry* outTelemetry = nullptr);
+
+    // decompress RGB image
+    // chroma channels are decoded directly at the luma resolution (where the supported resolutions allow)
+    // optionally, returns stats of every channel (array of COLOR_NUM_CHANNELS elements)
+    bool Decompress(Image& outImage, const DecompressionSettings& settings = DecompressionSettings(),
+                    DecompressionStats* outStats = nullptr) const;
+
+    // decompress separate YCbCr images (e.g. for Image::SaveYCbCr), chroma images may be smaller than luma
+    bool Decompress(Image& outY, Image& outCb, Image& outCr, const DecompressionSettings& settings = DecompressionSettings(),
+                    DecompressionStats* outStats = nullptr) const;
+
+    // compressor of a single channel (0 - Y, 1 - Cb, 2 - Cr)
+    const Compressor& GetChannel(uint32 index) const
+    {
+        assert(index < COLOR_NUM_CHANNELS);
+        return *mChannels[index];
+    }
+
+private:
+    std::unique_ptr<Compressor> mChannels[COLOR_NUM_CHANNELS];
+};
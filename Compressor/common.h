@@ -2,12 +2,18 @@
 
 #include <immintrin.h>
 
+#if defined(_MSC_VER)
 #define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
 
 using uint8 = unsigned char;
 using uint16 = unsigned short;
 using uint32 = unsigned int;
+using uint64 = unsigned long long;
 using int8 = signed char;
 using int16 = signed short;
 using int32 = signed int;
+using int64 = signed long long;
 using Vector = __m128;
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "compressed_image_view.h"
+
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <stdint.h>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// the raw words are little-endian, so they can be referenced only by little-endian hosts
+bool IsLittleEndianHost()
+{
+    const uint32 value = 1;
+    return *reinterpret_cast<const uint8*>(&value) == 1;
+}
+
+bool IsWordAligned(const uint8* data)
+{
+    return ((uintptr_t)data % sizeof(uint32)) == 0;
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+CompressedImageView::CompressedImageView()
+    : mImageSize(0)
+    , mMinRangeSize(0)
+    , mMaxRangeSize(0)
+    , mIterationHint(0)
+{ }
+
+bool CompressedImageView::Open(const std::string& name, uint32 channelIndex, bool verifyChecksum)
+{
+    Close();
+
+    if (!IsLittleEndianHost())
+    {
+        std::cout << "Raw compressed files can't be used in place on big-endian hosts" << std::endl;
+        return false;
+    }
+
+    // always mapped - small files would be read to a buffer, which is what the view avoids
+    if (!mFile.Open(name.c_str()))
+    {
+        return false;
+    }
+
+    std::vector<Compressor::ChannelChunks> channels;
+    if (!Compressor::ReadChannels(mFile.GetData(), mFile.GetSize(), channels, verifyChecksum))
+    {
+        Close();
+        return false;
+    }
+
+    if (channelIndex >= channels.size())
+    {
+        std::cout << "Compressed file contains " << channels.size() << " channel(s), channel " << channelIndex << " requested" << std::endl;
+        Close();
+        return false;
+    }
+
+    const Compressor::ChannelChunks& chunks = channels[channelIndex];
+    if (!chunks.rawQuadtree.data || !chunks.rawDomains.data)
+    {
+        std::cout << "File '" << name << "' is entropy coded, only files saved in the raw layout can be used in place" << std::endl;
+        Close();
+        return false;
+    }
+
+    Compressor::ChannelParameters parameters;
+    if (!Compressor::ReadParameters(chunks, (uint32)channels.size(), parameters))
+    {
+        Close();
+        return false;
+    }
+
+    const uint8* quadtreeWords = nullptr;
+    const uint8* packedDomains = nullptr;
+    uint32 numFlags = 0, numDomains = 0;
+    if (!Compressor::ReadRawQuadtree(chunks.rawQuadtree, quadtreeWords, numFlags) ||
+        !Compressor::ReadRawDomains(chunks.rawDomains, packedDomains, numDomains) ||
+        !IsWordAligned(quadtreeWords) || !IsWordAligned(packedDomains))
+    {
+        std::cout << "Corrupted file (raw quadtree or domains)" << std::endl;
+        Close();
+        return false;
+    }
+
+    // optional, the rows are referenced in place as well
+    QuadtreeIndexView index;
+    if (chunks.rowIndex.data)
+    {
+        const uint8* rows = nullptr;
+        uint32 numRows = 0;
+        if (!Compressor::ReadRowIndex(chunks.rowIndex, rows, numRows) || !IsWordAligned(rows) ||
+            numRows != parameters.imageSize / parameters.maxRangeSize)
+        {
+            std::cout << "Corrupted file (quadtree index)" << std::endl;
+            Close();
+            return false;
+        }
+
+        index = QuadtreeIndexView(reinterpret_cast<const QuadtreeIndex::Row*>(rows), numRows);
+        if (!index.IsConsistent(numFlags, numDomains))
+        {
+            std::cout << "Corrupted file (quadtree index)" << std::endl;
+            Close();
+            return false;
+        }
+    }
+
+    mImageSize = parameters.imageSize;
+    mMinRangeSize = parameters.minRangeSize;
+    mMaxRangeSize = parameters.maxRangeSize;
+    mIterationHint = parameters.iterationHint;
+    mQuadtreeCode = QuadtreeCodeView(reinterpret_cast<const QuadtreeCode::ElementType*>(quadtreeWords), numFlags);
+    mDomains = DomainArrayView(reinterpret_cast<const uint32*>(packedDomains), numDomains);
+    mIndex = index;
+    return true;
+}
+
+void CompressedImageView::Close()
+{
+    mQuadtreeCode = QuadtreeCodeView();
+    mDomains = DomainArrayView();
+    mIndex = QuadtreeIndexView();
+    mImageSize = 0;
+    mMinRangeSize = 0;
+    mMaxRangeSize = 0;
+    mIterationHint = 0;
+    mFile.Close();
+}
+
+bool CompressedImageView::BuildDecodePlan(DecodePlan& outPlan, int32 resolutionShift, ThreadPool* threadPool) const
+{
+    if (mDomains.GetSize() == 0)
+    {
+        std::cout << "There is no encoded data" << std::endl;
+        return false;
+    }
+
+    if (resolutionShift < DECODE_MIN_RESOLUTION_SHIFT || resolutionShift > DECODE_MAX_RESOLUTION_SHIFT)
+    {
+        std::cout << "Unsupported decoding resolution shift: " << resolutionShift << std::endl;
+        return false;
+    }
+
+    return outPlan.Build(mQuadtreeCode, mDomains, mImageSize, mMinRangeSize, mMaxRangeSize, true, resolutionShift,
+                         mIndex, threadPool);
+}
+
+bool CompressedImageView::Decompress(Image& outImage, const DecompressionSettings& settings, DecompressionStats* outStats) const
+{
+    // the rows are built in parallel only with the index
+    std::unique_ptr<ThreadPool> threadPool;
+    const uint32 numThreads = settings.numThreads > 0 ? settings.numThreads : std::thread::hardware_concurrency();
+    if (numThreads > 1 && !mIndex.IsEmpty())
+    {
+        threadPool.reset(new ThreadPool(numThreads));
+    }
+
+    DecodePlan plan;
+    if (!BuildDecodePlan(plan, settings.resolutionShift, threadPool.get()))
+    {
+        return false;
+    }
+
+    Decoder decoder;
+    if (!decoder.Decode(plan, settings, outStats))
+    {
+        return false;
+    }
+
+    outImage = decoder.TakeImage();
+    return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "compressor.h"
+#include "mapped_file.h"
+
+#include <string>
+
+
+/**
+* Compressed image used in place: the file stays memory mapped and the split flags and domains are read
+* directly from the mapping, nothing is decoded nor copied when the file is opened.
+* Only files in the raw layout (see Compressor::SaveRaw) can be viewed - the entropy coded chunks must be
+* decoded to memory (see Compressor::Load).
+* The stored row index (if present) locates every row of root ranges, so the rows can be parsed independently
+* (e.g. in parallel, or only the rows covering a region) without walking the preceding split flags.
+* NOTE: the views returned by GetQuadtreeCode(), GetDomains() and GetIndex() are valid until the file is closed,
+* decode plans don't refer to the mapping
+*/
+class CompressedImageView
+{
+public:
+    CompressedImageView();
+
+    // map the file and locate the raw chunks of given channel
+    // 'verifyChecksum' reads the whole file to verify its checksum, otherwise only the container structure
+    // and the chunk sizes are validated (consistency of the split flags and domains is checked by DecodePlan::Build,
+    // the index is checked only to be ordered and to span all the split flags and domains)
+    bool Open(const std::string& name, uint32 channelIndex = 0, bool verifyChecksum = false);
+
+    // unmap the file
+    void Close();
+
+    // compile the mapped data for decoding (see DecodePlan::Build)
+    // rows of root ranges are built in parallel if 'threadPool' is given and the file has the row index
+    bool BuildDecodePlan(DecodePlan& outPlan, int32 resolutionShift = 0, ThreadPool* threadPool = nullptr) const;
+
+    // decompress an image (with a temporary decode plan and decoder)
+    bool Decompress(Image& outImage, const DecompressionSettings& settings = DecompressionSettings(),
+                    DecompressionStats* outStats = nullptr) const;
+
+    uint32 GetImageSize() const
+    {
+        return mImageSize;
+    }
+
+    uint32 GetMinRangeSize() const
+    {
+        return mMinRangeSize;
+    }
+
+    uint32 GetMaxRangeSize() const
+    {
+        return mMaxRangeSize;
+    }
+
+    // see Compressor::GetIterationHint
+    uint32 GetIterationHint() const
+    {
+        return mIterationHint;
+    }
+
+    const QuadtreeCodeView& GetQuadtreeCode() const
+    {
+        return mQuadtreeCode;
+    }
+
+    const DomainArrayView& GetDomains() const
+    {
+        return mDomains;
+    }
+
+    // empty if the file has no row index
+    const QuadtreeIndexView& GetIndex() const
+    {
+        return mIndex;
+    }
+
+private:
+    MappedFile mFile;
+
+    uint32 mImageSize;
+    uint32 mMinRangeSize;
+    uint32 mMaxRangeSize;
+    uint32 mIterationHint;
+
+    // point into the mapped file
+    QuadtreeCodeView mQuadtreeCode;
+    DomainArrayView mDomains;
+    QuadtreeIndexView mIndex;
+};
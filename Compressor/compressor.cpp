@@ -1,59 +1,77 @@
 #include "compressor.h"
 #include "quadtree.h"
+#include "domain_coder.h"
+#include "quadtree_coder.h"
+#include "container.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 #include <iostream>
 #include <assert.h>
 #include <algorithm>
 #include <iomanip>
 #include <thread>
+#include <chrono>
 #include <fstream>
+#include <functional>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <atomic>
+#include <condition_variable>
 
 
 //#define DISABLE_QUADTREE_SUBDIVISION
 
 //////////////////////////////////////////////////////////////////////////
 
-#define HEADER_MAGIC 'icf '
+// container chunks (see ContainerWriter)
+#define CHUNK_PARAMETERS    CONTAINER_TAG('P', 'A', 'R', 'M')   // image size, range sizes, domain bit widths, iteration hint
+#define CHUNK_CHANNELS      CONTAINER_TAG('C', 'H', 'A', 'N')   // channel layout
+#define CHUNK_QUADTREE      CONTAINER_TAG('Q', 'T', 'R', 'E')   // split flags (see QuadtreeCoder)
+#define CHUNK_DOMAINS       CONTAINER_TAG('D', 'O', 'M', 'S')   // domains (see DomainCoder)
+#define CHUNK_QUADTREE_RAW  CONTAINER_TAG('Q', 'R', 'A', 'W')   // split flags as QuadtreeCode words (see Compressor::SaveRaw)
+#define CHUNK_DOMAINS_RAW   CONTAINER_TAG('D', 'R', 'A', 'W')   // packed domains (see Domain::Pack)
+#define CHUNK_ROW_INDEX     CONTAINER_TAG('R', 'I', 'D', 'X')   // first split flag and domain of every row of root ranges (see QuadtreeIndex)
 
-struct Header
+// domain locations are coded relative to their range blocks (see DomainCoder::PredictLocations)
+#define DOMAINS_FLAG_PREDICTED_POSITIONS (1 << 0)
+
+// files written before the chunked container (raw LegacyHeader structure)
+#define LEGACY_MAGIC 'icf '
+
+// CompressorSettings as stored by the legacy files
+struct LegacySettings
+{
+    float mseMultiplier;
+    uint8 minRangeSize;
+    uint8 maxRangeSize;
+    bool disableImportance;
+    uint8 padding;
+};
+
+struct LegacyHeader
 {
     uint32 magic;
     uint32 imageSize;
     uint32 quadtreeDataSize;    // in bits
     uint32 numDomains;
-    CompressorSettings settings;
+    LegacySettings settings;
 };
 
+static_assert(sizeof(LegacyHeader) == 24, "Legacy header layout must not change");
+
 //////////////////////////////////////////////////////////////////////////
 
 namespace {
 
-FORCE_INLINE void TransformLocation(uint32 rangeSize, uint32 x, uint32 y, uint8 transform, uint32& outX, uint32& outY)
+using Clock = std::chrono::high_resolution_clock;
+
+FORCE_INLINE double GetSeconds(const Clock::time_point& start, const Clock::time_point& end)
 {
-    const uint32 offset = rangeSize - 1;
-
-    if (transform & 0x1)
-        x = offset - x;
-
-    switch (transform >> 1)
-    {
-    case 0:
-        outX = x;
-        outY = y;
-        break;
-    case 1:
-        outX = offset - y;
-        outY = x;
-        break;
-    case 2:
-        outX = offset - x;
-        outY = offset - y;
-        break;
-    case 3:
-        outX = y;
-        outY = offset - x;
-        break;
-    }
+    return std::chrono::duration<double>(end - start).count();
 }
 
 } // namespace
@@ -61,7 +79,11 @@ FORCE_INLINE void TransformLocation(uint32 rangeSize, uint32 x, uint32 y, uint8
 //////////////////////////////////////////////////////////////////////////
 
 Compressor::Compressor(const CompressorSettings& settings)
-    : mSettings(settings)
+    : mSize(0)
+    , mSizeBits(0)
+    , mSizeMask(0)
+    , mSettings(settings)
+    , mIterationHint(0)
 {}
 
 //////////////////////////////////////////////////////////////////////////
@@ -109,7 +131,7 @@ float Compressor::MatchDomain(const DomainMatchParams& params, uint8 rangeSize,
     // find pixel value scaling and offset coefficients that minimizes MSE
     float term0 = (float)k * (float)gh - (float)gSum * (float)hSum;
     float term1 = (float)k * (float)gSqrSum - (float)gSum * (float)gSum;
-    if (abs(term1) < 0.0001f)
+    if (std::abs(term1) < 0.0001f)
     {
         outScale = 0.0f;
         outOffset = (float)hSum * invK;
@@ -127,24 +149,43 @@ float Compressor::MatchDomain(const DomainMatchParams& params, uint8 rangeSize,
 
     // calculate MSE (including color scaling and offset)
     uint32 diffSum = 0;
-    for (uint32 i = 0; i < k; ++i)
+    for (uint32 i = 0; i < k; )
     {
-        int32 g = (int32)d.TransformColor(rangeCtx.domainDataCache[i]);
-        int32 h = (int32)rangeCtx.rangeDataCache[i];
-        int32 diff = g - h;
-        diffSum += diff * diff;
+        for (uint32 rowEnd = i + rangeSize; i < rowEnd; ++i)
+        {
+            int32 g = (int32)d.TransformColor(rangeCtx.domainDataCache[i]);
+            int32 h = (int32)rangeCtx.rangeDataCache[i];
+            int32 diff = g - h;
+            diffSum += diff * diff;
+        }
+
+        // the error can only grow, so stop as soon as this domain can't be the best one
+        if ((float)diffSum * invK > params.maxCost)
+        {
+            rangeCtx.stats.earlyOuts++;
+            break;
+        }
     }
     return (float)diffSum * invK;
 }
 
 float Compressor::DomainSearch(const RangeContext& rangeContext, uint8 rangeSize, Domain& outDomain) const
 {
+#ifndef DISABLE_TRACE
+    TraceScope traceScope(rangeSize >= TRACE_MIN_DOMAIN_SEARCH_SIZE ? "DomainSearch" : nullptr, "size", rangeSize);
+#endif // DISABLE_TRACE
+
     Domain bestDomain;
     float bestCost = FLT_MAX;
 
     const uint32 domainScaling = mSizeBits > DOMAIN_LOCATION_BITS ? mSizeBits - DOMAIN_LOCATION_BITS : 0;
     const uint32 maxDomainLocations = std::min<uint32>(mSize, 1 << DOMAIN_LOCATION_BITS);
 
+    // equally good domains closer to the range block are cheaper to code
+    const uint32 predictedX = (rangeContext.rx0 >> domainScaling) & ((1 << DOMAIN_LOCATION_BITS) - 1);
+    const uint32 predictedY = (rangeContext.ry0 >> domainScaling) & ((1 << DOMAIN_LOCATION_BITS) - 1);
+    uint32 bestDistance = 0xFFFFFFFF;
+
     DomainMatchParams matchParams(rangeContext);
 
     // iterate through all possible domains locations
@@ -159,10 +200,17 @@ float Compressor::DomainSearch(const RangeContext& rangeContext, uint8 rangeSize
             for (uint8 t = 0; t < DOMAIN_MAX_TRANSFORMS; ++t)
             {
                 matchParams.transform = t;
+                matchParams.maxCost = bestCost;
 
                 float scale, offset;
                 const float currentCost = MatchDomain(matchParams, rangeSize, scale, offset);
-                if (currentCost < bestCost)
+                if (currentCost > bestCost)
+                {
+                    continue;
+                }
+
+                const uint32 distance = DomainCoder::GetLocationDistance(x, predictedX) + DomainCoder::GetLocationDistance(y, predictedY);
+                if (currentCost < bestCost || (mSettings.predictDomainPositions && distance < bestDistance))
                 {
                     bestDomain.x = x;
                     bestDomain.y = y;
@@ -171,11 +219,14 @@ float Compressor::DomainSearch(const RangeContext& rangeContext, uint8 rangeSize
                     bestDomain.SetScale(scale);
 
                     bestCost = currentCost;
+                    bestDistance = distance;
                 }
             }
         }
     }
 
+    rangeContext.stats.candidatesEvaluated += maxDomainLocations * maxDomainLocations * DOMAIN_MAX_TRANSFORMS;
+
     outDomain = bestDomain;
     return bestCost;
 }
@@ -197,8 +248,8 @@ uint32 Compressor::CompressRootRange(const RangeContext& rangeContext,
 
     uint32 numDomainsInTree = 0;
 
-    std::function<void(uint32, uint32, uint8, float)> compressSubRange;
-    compressSubRange = [&](uint32 rx0, uint32 ry0, uint8 rangeSize, float mseThreshold)
+    std::function<void(uint32, uint32, uint8, float, uint32)> compressSubRange;
+    compressSubRange = [&](uint32 rx0, uint32 ry0, uint8 rangeSize, float mseThreshold, uint32 level)
     {
         RangeContext subRangeContext(rangeContext);
         subRangeContext.rx0 = rx0;
@@ -206,6 +257,7 @@ uint32 Compressor::CompressRootRange(const RangeContext& rangeContext,
 
         Domain domain;
         const float mse = DomainSearch(subRangeContext, rangeSize, domain);
+        rangeContext.stats.AddSearch(level, mse);
 
         bool subdivide = false;
 
@@ -223,16 +275,18 @@ uint32 Compressor::CompressRootRange(const RangeContext& rangeContext,
             const uint8 subRangeSize = rangeSize / 2;
             const float subRangeThreshold = mseThreshold * adaptiveThresholdFactor;
 
-            compressSubRange(rx0,                   ry0,                subRangeSize, subRangeThreshold);
-            compressSubRange(rx0 + subRangeSize,    ry0,                subRangeSize, subRangeThreshold);
-            compressSubRange(rx0,                   ry0 + subRangeSize, subRangeSize, subRangeThreshold);
-            compressSubRange(rx0 + subRangeSize,    ry0 + subRangeSize, subRangeSize, subRangeThreshold);
+            rangeContext.stats.splits[level]++;
+
+            compressSubRange(rx0,                   ry0,                subRangeSize, subRangeThreshold, level + 1);
+            compressSubRange(rx0 + subRangeSize,    ry0,                subRangeSize, subRangeThreshold, level + 1);
+            compressSubRange(rx0,                   ry0 + subRangeSize, subRangeSize, subRangeThreshold, level + 1);
+            compressSubRange(rx0 + subRangeSize,    ry0 + subRangeSize, subRangeSize, subRangeThreshold, level + 1);
         }
         else
         {
             /*
             {
-                std::lock_guard<std::mutex> lock(mMutex);
+                std::lock_guard<std::mutex> lock(mEncoderMutex);
                 std::cout << "Range " << std::setw(3) << rx0 << ',' << std::setw(3) << ry0 << " (" << std::setw(2) << rangeSize << " px) -> "
                     << "Domain: loc=(" << std::setw(3) << (uint32)domain.x << "," << std::setw(3) << (uint32)domain.y << ")"
                     << ", t=" << (uint32)domain.transform
@@ -241,16 +295,28 @@ uint32 Compressor::CompressRootRange(const RangeContext& rangeContext,
                     << "MSE=" << std::setw(8) << std::setprecision(3) << mse << std::endl;
             }
             */
+            rangeContext.stats.leaves[level]++;
             outDomains.push_back(domain);
             numDomainsInTree++;
         }
     };
 
-    compressSubRange(rangeContext.rx0, rangeContext.ry0, mSettings.maxRangeSize, initialThreshold);
+    compressSubRange(rangeContext.rx0, rangeContext.ry0, mSettings.maxRangeSize, initialThreshold, 0);
+    rangeContext.stats.rootRanges++;
     return numDomainsInTree;
 }
 
-bool Compressor::Compress(const Image& image)
+bool Compressor::Compress(const Image& image, EncoderTelemetry* outTelemetry, EncoderSink* sink)
+{
+    return Encode(image, outTelemetry, sink, true);
+}
+
+bool Compressor::CompressToSink(const Image& image, EncoderSink& sink, EncoderTelemetry* outTelemetry)
+{
+    return Encode(image, outTelemetry, &sink, false);
+}
+
+bool Compressor::Encode(const Image& image, EncoderTelemetry* outTelemetry, EncoderSink* sink, bool keepOutput)
 {
     const uint32 maxRangeSize = mSettings.maxRangeSize;
 
@@ -260,27 +326,104 @@ bool Compressor::Compress(const Image& image)
         return false;
     }
 
+    uint32 numLevels = 1;
+    while ((uint32)(mSettings.minRangeSize << (numLevels - 1)) < maxRangeSize)
+        numLevels++;
+
+    if (numLevels > TELEMETRY_MAX_LEVELS)
+    {
+        std::cout << "Too many quadtree levels" << std::endl;
+        return false;
+    }
+
     mSize = image.GetSize();
     mSizeBits = image.GetSizeBits();
     mSizeMask = image.GetSizeMask();
 
     const uint32 numRangesInColumn = image.GetSize() / maxRangeSize;
     const uint32 numThreads = std::min<uint32>(numRangesInColumn, std::thread::hardware_concurrency());
-    const uint32 rowsPerThread = numRangesInColumn / numThreads;
     const uint32 totalRangeBlocks = numRangesInColumn * numRangesInColumn;
 
+    mQuadtreeCode.Clear();
+    mDomains.clear();
+    mQuadtreeIndex.Clear();
+    mIterationHint = 0;
+    for (std::shared_ptr<const DecodePlan>& plan : mDecodePlans)
+    {
+        plan.reset();
+    }
+
+    if (sink && !sink->Begin(mSize, mSettings.minRangeSize, maxRangeSize))
+    {
+        std::cout << "Encoder output sink failed" << std::endl;
+        return false;
+    }
+
+    // root ranges are handed out in the raster order, so only the ranges finished ahead of
+    // a range still in progress wait in the reorder buffer
+    std::atomic<uint32> nextRangeBlock(0);
+    std::atomic<bool> sinkFailed(false);
+
+    // reorder buffer (guarded by mEncoderMutex)
+    // a thread may start root ranges only within the window following the oldest unfinished one - the thread
+    // compressing that one never waits, so the window always moves forward
+    struct FinishedRootRange
+    {
+        QuadtreeCode quadtreeCode;
+        std::vector<Domain> domains;
+    };
+    std::map<uint32, FinishedRootRange> finishedRootRanges;
+    std::condition_variable reorderWindowMoved;
+    const uint32 reorderWindowSize = COMPRESSOR_REORDER_WINDOW_PER_THREAD * numThreads;
+    uint32 numEmittedRangeBlocks = 0;
     uint32 finishedRangeBlocks = 0;
+    double mergeTime = 0.0;
 
-    std::vector<QuadtreeCode> quadtreesPerThread;
-    std::vector<std::vector<Domain>> domainsPerThread;
-    quadtreesPerThread.resize(numThreads);
-    domainsPerThread.resize(numThreads);
+    // append finished root range to the compressed data and pass it to the sink (the merge phase)
+    // NOTE: called in the raster order with mEncoderMutex locked
+    const auto emitRootRange = [&](uint32 rangeIndex, const FinishedRootRange& rootRange) -> bool
+    {
+        TRACE_SCOPE("Merge", "rangeIndex", rangeIndex);
+        const Clock::time_point mergeStart = Clock::now();
+
+        if (keepOutput)
+        {
+            // the index is built on the fly, the first root range of a row starts a new index row
+            if (rangeIndex % numRangesInColumn == 0)
+            {
+                mQuadtreeIndex.AddRow(mQuadtreeCode.GetSize(), (uint32)mDomains.size());
+            }
+
+            mQuadtreeCode.Push(rootRange.quadtreeCode);
+            mDomains.insert(mDomains.end(), rootRange.domains.begin(), rootRange.domains.end());
+        }
+
+        bool success = true;
+        if (sink)
+        {
+            EncodedRootRange encodedRootRange;
+            encodedRootRange.index = rangeIndex;
+            encodedRootRange.rx0 = (rangeIndex % numRangesInColumn) * maxRangeSize;
+            encodedRootRange.ry0 = (rangeIndex / numRangesInColumn) * maxRangeSize;
+            encodedRootRange.quadtreeCode = &rootRange.quadtreeCode;
+            encodedRootRange.domains = rootRange.domains.data();
+            encodedRootRange.numDomains = (uint32)rootRange.domains.size();
+            success = sink->OnRootRange(encodedRootRange);
+        }
+
+        mergeTime += GetSeconds(mergeStart, Clock::now());
+        return success;
+    };
+
+    std::vector<EncoderThreadStats> statsPerThread;
+    statsPerThread.resize(numThreads);
+
+    const Clock::time_point searchStart = Clock::now();
 
     const auto threadCallback = [&](uint32 threadID)
     {
         assert(threadID < numThreads);
-        std::vector<Domain>& domains = domainsPerThread[threadID];
-        QuadtreeCode& quadtreeCode = quadtreesPerThread[threadID];
+        EncoderThreadStats& stats = statsPerThread[threadID];
 
         const uint32 numRangePixels = maxRangeSize * maxRangeSize;
 
@@ -289,26 +432,73 @@ bool Compressor::Compress(const Image& image)
         domainDataCache.resize(numRangePixels);
         rangeDataCache.resize(numRangePixels);
 
-        RangeContext rangeContext(image, rangeDataCache, domainDataCache);
+        RangeContext rangeContext(image, rangeDataCache, domainDataCache, stats);
 
-        for (uint32 i = 0; i < rowsPerThread; ++i) // iterate local rows
+        while (!sinkFailed)
         {
-            // range block Y coordinate
-            rangeContext.ry0 = maxRangeSize * (rowsPerThread * threadID + i);
+            const uint32 rangeIndex = nextRangeBlock++;
+            if (rangeIndex >= totalRangeBlocks)
+            {
+                break;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(mEncoderMutex);
+                reorderWindowMoved.wait(lock, [&]()
+                {
+                    return rangeIndex < numEmittedRangeBlocks + reorderWindowSize || sinkFailed;
+                });
+            }
+
+            if (sinkFailed)
+            {
+                break;
+            }
+
+            // range block coordinates
+            rangeContext.rx0 = (rangeIndex % numRangesInColumn) * maxRangeSize;
+            rangeContext.ry0 = (rangeIndex / numRangesInColumn) * maxRangeSize;
 
-            for (uint32 rx0 = 0; rx0 < image.GetSize(); rx0 += maxRangeSize) // range block X coordinate
+            FinishedRootRange rootRange;
             {
-                rangeContext.rx0 = rx0;
-                const uint32 numDomainsInTree = CompressRootRange(rangeContext, quadtreeCode, domains);
+                TRACE_SCOPE("CompressRootRange", "rx", rangeContext.rx0, "ry", rangeContext.ry0);
+
+                const Clock::time_point rangeStart = Clock::now();
+                CompressRootRange(rangeContext, rootRange.quadtreeCode, rootRange.domains);
+                stats.busyTime += GetSeconds(rangeStart, Clock::now());
+            }
+
+            std::lock_guard<std::mutex> lock(mEncoderMutex);
+
+            // emit all the consecutive finished root ranges
+            if (rangeIndex == numEmittedRangeBlocks && !sinkFailed)
+            {
+                bool success = emitRootRange(rangeIndex, rootRange);
+                numEmittedRangeBlocks++;
+
+                auto next = finishedRootRanges.begin();
+                while (success && next != finishedRootRanges.end() && next->first == numEmittedRangeBlocks)
+                {
+                    success = emitRootRange(next->first, next->second);
+                    numEmittedRangeBlocks++;
+                    next = finishedRootRanges.erase(next);
+                }
 
-                // progress indicator
+                if (!success)
                 {
-                    std::lock_guard<std::mutex> lock(mMutex);
-                    finishedRangeBlocks++;
-                    std::cout << std::setw(5) << finishedRangeBlocks << " /" << std::setw(5) << totalRangeBlocks << " (" <<
-                        std::setw(8) << std::setprecision(3) << (100.0f * (float)finishedRangeBlocks / (float)totalRangeBlocks) << "%)\r";
+                    sinkFailed = true;
                 }
+                reorderWindowMoved.notify_all();
+            }
+            else
+            {
+                finishedRootRanges.emplace(rangeIndex, std::move(rootRange));
             }
+
+            // progress indicator
+            finishedRangeBlocks++;
+            std::cout << std::setw(5) << finishedRangeBlocks << " /" << std::setw(5) << totalRangeBlocks << " (" <<
+                std::setw(8) << std::setprecision(3) << (100.0f * (float)finishedRangeBlocks / (float)totalRangeBlocks) << "%)\r";
         }
     };
 
@@ -319,26 +509,39 @@ bool Compressor::Compress(const Image& image)
         threads.emplace_back(threadCallback, i);
     }
 
-    // wait for threads and merge results (domains + quadtrees)
-    mQuadtreeCode.Clear();
-    mDomains.clear();
     for (uint32 i = 0; i < numThreads; ++i)
     {
         threads[i].join();
+    }
 
-        for (const Domain& domain : domainsPerThread[i])
-        {
-            mDomains.push_back(domain);
-        }
+    const Clock::time_point searchEnd = Clock::now();
+
+    if (sinkFailed || (sink && !sink->End()))
+    {
+        std::cout << std::endl << "Encoder output sink failed" << std::endl;
+        mQuadtreeCode.Clear();
+        mDomains.clear();
+        mQuadtreeIndex.Clear();
+        return false;
+    }
+    assert(numEmittedRangeBlocks == totalRangeBlocks);
 
-        mQuadtreeCode.Push(quadtreesPerThread[i]);
+    if (keepOutput)
+    {
+        // terminating entry of the index
+        mQuadtreeIndex.AddRow(mQuadtreeCode.GetSize(), (uint32)mDomains.size());
     }
 
+    const Clock::time_point mergeEnd = Clock::now();
+
     std::cout << std::endl;
 
     // print domains stats
+    DomainsStats domainStats;
+    if (keepOutput)
     {
-        DomainsStats domainStats = CalculateDomainStats();
+        domainStats = CalculateDomainStats();
+
         std::cout << std::endl << "=== DOMAINS STATS ===" << std::endl;
         std::cout << "Average offset:   " << domainStats.averageOffset << std::endl;
         std::cout << "Offset variance:  " << domainStats.offsetVariance << std::endl;
@@ -353,15 +556,45 @@ bool Compressor::Compress(const Image& image)
         for (int i = 0; i < 8; ++i)
             std::cout << i << "(" << domainStats.transformDistribution[i] << ") ";
         std::cout << std::endl;
+
+        // coded sizes are reported when the data is saved (see WriteChannel)
+        std::cout << "Num domains:     " << mDomains.size() << std::endl;
+        std::cout << "Num split flags: " << mQuadtreeCode.GetSize() << std::endl;
     }
 
-    const size_t domainsDataSize = mDomains.size() * sizeof(Domain);
-    const size_t quadtreeElements = mQuadtreeCode.GetNumElements();
-    const size_t totalSize = domainsDataSize + sizeof(QuadtreeCode::ElementType) * quadtreeElements;
-    const float bitsPerPixel = (float)(totalSize * 8) / (float)(image.GetSize() * image.GetSize());
-    std::cout << "Num domains:     " << mDomains.size() << std::endl;
-    std::cout << "Quadtree size:   " << mQuadtreeCode.GetSize() << std::endl;
-    std::cout << "Compressed size: " << totalSize << " bytes (" << std::setw(8) << std::setprecision(4) << bitsPerPixel << " bpp)" << std::endl;
+    if (outTelemetry)
+    {
+        EncoderTelemetry& telemetry = *outTelemetry;
+        telemetry.imageSize = mSize;
+        telemetry.minRangeSize = mSettings.minRangeSize;
+        telemetry.maxRangeSize = mSettings.maxRangeSize;
+        telemetry.numLevels = numLevels;
+        telemetry.domainsStats = domainStats;
+        telemetry.totals = EncoderThreadStats();
+        telemetry.threads = statsPerThread;
+
+        for (uint32 i = 0; i < numThreads; ++i)
+        {
+            // threads are idle when they finished their work but others did not
+            EncoderThreadStats& stats = telemetry.threads[i];
+            stats.idleTime = std::max<double>(0.0, GetSeconds(searchStart, searchEnd) - stats.busyTime);
+            telemetry.totals.Merge(stats);
+        }
+
+        // conversion phase happens outside of the compressor, so it's left untouched
+        telemetry.phaseTime[(uint32)EncoderPhase::Search] = GetSeconds(searchStart, searchEnd);
+        telemetry.phaseTime[(uint32)EncoderPhase::Merge] = mergeTime;
+        telemetry.phaseTime[(uint32)EncoderPhase::Stats] = GetSeconds(mergeEnd, Clock::now());
+    }
+
+    // iterations needed by the default decoder (stored in the file as a hint for decoders)
+    if (keepOutput && mSettings.computeIterationHint)
+    {
+        Image decompressed;
+        DecompressionStats decompressionStats;
+        mIterationHint = Decompress(decompressed, DecompressionSettings(), &decompressionStats) ? decompressionStats.iterations : 0;
+        std::cout << "Iteration hint:  " << mIterationHint << std::endl;
+    }
 
     return true;
 }
@@ -407,235 +640,726 @@ DomainsStats Compressor::CalculateDomainStats() const
 // Decompression
 //////////////////////////////////////////////////////////////////////////
 
-void Compressor::DecompressRange(const RangeDecompressContext& context) const
+bool Compressor::Decompress(Image& outImage, const DecompressionSettings& settings, DecompressionStats* outStats) const
+{
+    if (mDomains.empty())
+    {
+        std::cout << "There is no encoded data" << std::endl;
+        return false;
+    }
+
+    const std::shared_ptr<const DecodePlan> plan = GetDecodePlan(settings.resolutionShift, settings.numThreads);
+    if (!plan)
+    {
+        return false;
+    }
+
+    Decoder decoder;
+    if (!decoder.Decode(*plan, settings, outStats))
+    {
+        return false;
+    }
+
+    outImage = decoder.TakeImage();
+    return true;
+}
+
+bool Compressor::DecompressRegion(uint32 x, uint32 y, uint32 width, uint32 height, Image& outImage,
+                                  const DecompressionSettings& settings, DecompressionStats* outStats) const
+{
+    if (mDomains.empty())
+    {
+        std::cout << "There is no encoded data" << std::endl;
+        return false;
+    }
+
+    const std::shared_ptr<const DecodePlan> plan = GetDecodePlan(settings.resolutionShift, settings.numThreads);
+    if (!plan)
+    {
+        return false;
+    }
+
+    Decoder decoder;
+    if (!decoder.DecodeRegion(*plan, x, y, width, height, settings, outStats))
+    {
+        return false;
+    }
+
+    outImage = decoder.TakeImage();
+    return true;
+}
+
+std::shared_ptr<const DecodePlan> Compressor::GetDecodePlan(int32 resolutionShift, uint32 numThreads) const
+{
+    if (resolutionShift < DECODE_MIN_RESOLUTION_SHIFT || resolutionShift > DECODE_MAX_RESOLUTION_SHIFT)
+    {
+        std::cout << "Unsupported decoding resolution shift: " << resolutionShift << std::endl;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mDecodePlansMutex);
+
+    std::shared_ptr<const DecodePlan>& decodePlan = mDecodePlans[resolutionShift - DECODE_MIN_RESOLUTION_SHIFT];
+    if (!decodePlan)
+    {
+        TRACE_SCOPE("BuildDecodePlan", "resolutionShift", resolutionShift);
+
+        if (numThreads == 0)
+        {
+            numThreads = std::max<uint32>(1, std::thread::hardware_concurrency());
+        }
+
+        // the pool is kept for the following plans (other resolutions, or after loading another image)
+        if (numThreads > 1 && (!mPlanThreadPool || mPlanThreadPool->GetNumThreads() != numThreads))
+        {
+            mPlanThreadPool.reset(new ThreadPool(numThreads));
+        }
+
+        std::shared_ptr<DecodePlan> plan = std::make_shared<DecodePlan>();
+        if (!plan->Build(mQuadtreeCode, mDomains, mSize, mSettings.minRangeSize, mSettings.maxRangeSize,
+                         true, resolutionShift, mQuadtreeIndex, numThreads > 1 ? mPlanThreadPool.get() : nullptr))
+        {
+            return nullptr;
+        }
+        decodePlan = plan;
+    }
+
+    return decodePlan;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// Input-output
+//////////////////////////////////////////////////////////////////////////
+
+bool Compressor::Load(const std::string& name, uint32 channelIndex)
+{
+    // the file is parsed in place, decoded data does not refer to the mapping
+    MappedFile file;
+    if (!file.Open(name.c_str(), COMPRESSOR_MAPPED_FILE_MIN_SIZE))
+    {
+        return false;
+    }
+
+    return Load(file.GetData(), file.GetSize(), channelIndex);
+}
+
+bool Compressor::Load(const uint8* data, size_t size, uint32 channelIndex)
+{
+    uint32 magic = 0;
+    if (ByteReader(data, size).ReadUint32(magic) && magic == CONTAINER_MAGIC)
+    {
+        std::vector<ChannelChunks> channels;
+        if (!ReadChannels(data, size, channels))
+        {
+            return false;
+        }
+
+        if (channelIndex >= channels.size())
+        {
+            std::cout << "Compressed file contains " << channels.size() << " channel(s), channel " << channelIndex << " requested" << std::endl;
+            return false;
+        }
+
+        return LoadChannel(channels[channelIndex], (uint32)channels.size());
+    }
+
+    if (channelIndex != 0)
+    {
+        std::cout << "Compressed file contains single channel, channel " << channelIndex << " requested" << std::endl;
+        return false;
+    }
+
+    LoadedChannel channel;
+    if (!ReadLegacy(data, size, channel))
+    {
+        return false;
+    }
+
+    ApplyLoadedChannel(channel);
+    return true;
+}
+
+bool Compressor::ReadChannels(const uint8* data, size_t size, std::vector<ChannelChunks>& outChannels, bool verifyChecksum)
 {
-    assert(context.rangeSize >= mSettings.minRangeSize);
-    assert(context.rx0 < mSize);
-    assert(context.ry0 < mSize);
+    outChannels.clear();
 
-    // check if this range should be subdivided
-    bool subdivide = false;
-    if (context.rangeSize > mSettings.minRangeSize)
+    ContainerReader container(data, size, verifyChecksum);
+    if (!container.ReadHeader())
     {
-        subdivide = context.quadtreeCode.Get();
+        return false;
     }
 
-    if (subdivide)
+    // every channel section starts with the parameters chunk
+    uint32 tag, payloadSize;
+    const uint8* payload;
+    while (container.NextChunk(tag, payload, payloadSize))
     {
-        RangeDecompressContext childContext(context);
-        childContext.rangeSize /= 2;
-        for (uint32 i = 0; i < 2; ++i)
+        if (tag == CHUNK_PARAMETERS)
         {
-            for (uint32 j = 0; j < 2; ++j)
+            outChannels.push_back(ChannelChunks());
+        }
+
+        Chunk* chunk = nullptr;
+        if (!outChannels.empty())
+        {
+            ChannelChunks& channel = outChannels.back();
+            switch (tag)
+            {
+            case CHUNK_PARAMETERS:  chunk = &channel.parameters; break;
+            case CHUNK_CHANNELS:    chunk = &channel.channels; break;
+            case CHUNK_QUADTREE:    chunk = &channel.quadtree; break;
+            case CHUNK_DOMAINS:     chunk = &channel.domains; break;
+            case CHUNK_QUADTREE_RAW: chunk = &channel.rawQuadtree; break;
+            case CHUNK_DOMAINS_RAW: chunk = &channel.rawDomains; break;
+            case CHUNK_ROW_INDEX:   chunk = &channel.rowIndex; break;
+            default:                break; // unknown chunks are skipped
+            }
+        }
+
+        if (chunk)
+        {
+            if (chunk->data)
             {
-                childContext.rx0 = context.rx0 + j * childContext.rangeSize;
-                childContext.ry0 = context.ry0 + i * childContext.rangeSize;
-                DecompressRange(childContext);
+                std::cout << "Corrupted file (duplicated chunk)" << std::endl;
+                return false;
             }
+            chunk->data = payload;
+            chunk->size = payloadSize;
         }
     }
-    else // !subdivide
+
+    if (container.IsCorrupted())
     {
-        const uint32 domainScaling = mSizeBits > DOMAIN_LOCATION_BITS ? mSizeBits - DOMAIN_LOCATION_BITS : 0;
-        const Domain& domain = mDomains[context.domainIndex++];
+        std::cout << "Corrupted file (truncated data or checksum mismatch)" << std::endl;
+        return false;
+    }
 
-        for (uint32 y = 0; y < context.rangeSize; y++)
+    // split flags and domains are stored either entropy coded or raw
+    for (const ChannelChunks& channel : outChannels)
+    {
+        if (!channel.channels.data || !channel.quadtree.data == !channel.rawQuadtree.data ||
+            !channel.domains.data == !channel.rawDomains.data)
         {
-            const uint32 ry = context.ry0 + y;
+            std::cout << "Corrupted file (missing chunk)" << std::endl;
+            return false;
+        }
+    }
 
-            for (uint32 x = 0; x < context.rangeSize; x++)
-            {
-                // transform range block location to domain location
-                uint32 tx, ty;
-                TransformLocation(context.rangeSize, x, y, domain.transform, tx, ty);
+    if (outChannels.empty())
+    {
+        std::cout << "Corrupted file (missing chunk)" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool Compressor::ReadParameters(const ChannelChunks& chunks, uint32 numChannels, ChannelParameters& outParameters)
+{
+    // codec parameters
+    {
+        ByteReader reader(chunks.parameters.data, chunks.parameters.size);
+        uint32 imageSize = 0;
+        uint8 minRangeSize = 0, maxRangeSize = 0;
+        uint8 locationBits = 0, transformBits = 0, offsetBits = 0, offsetRangeBits = 0, scaleBits = 0, scaleRangeBits = 0;
+        uint16 iterationHint = 0;
+        if (!reader.ReadUint32(imageSize) || !reader.ReadUint8(minRangeSize) || !reader.ReadUint8(maxRangeSize) ||
+            !reader.ReadUint8(locationBits) || !reader.ReadUint8(transformBits) ||
+            !reader.ReadUint8(offsetBits) || !reader.ReadUint8(offsetRangeBits) ||
+            !reader.ReadUint8(scaleBits) || !reader.ReadUint8(scaleRangeBits) ||
+            !reader.ReadUint16(iterationHint))
+        {
+            std::cout << "Corrupted file (codec parameters)" << std::endl;
+            return false;
+        }
+
+        // domain layout is fixed at compile time (see settings.h)
+        if (locationBits != DOMAIN_LOCATION_BITS || transformBits != DOMAIN_TRANSFORM_BITS ||
+            offsetBits != DOMAIN_OFFSET_BITS || offsetRangeBits != DOMAIN_OFFSET_RANGE_BITS ||
+            scaleBits != DOMAIN_SCALE_BITS || scaleRangeBits != DOMAIN_SCALE_RANGE_BITS)
+        {
+            std::cout << "File was encoded with different domain bit widths (location " << (uint32)locationBits
+                      << ", transform " << (uint32)transformBits << ", offset " << (uint32)offsetBits << "/" << (uint32)offsetRangeBits
+                      << ", scale " << (uint32)scaleBits << "/" << (uint32)scaleRangeBits << ")" << std::endl;
+            return false;
+        }
 
-                // decode domain location (to picture space)
-                const uint32 dx = (domain.x << domainScaling) + 2 * tx;
-                const uint32 dy = (domain.y << domainScaling) + 2 * ty;
+        if (!IsValidGeometry(imageSize, minRangeSize, maxRangeSize))
+        {
+            return false;
+        }
 
-                // sample domain (with downsampling)
-                const uint32 domainPixelColor = context.srcImage.SampleDomain(dx, dy);
+        outParameters.imageSize = imageSize;
+        outParameters.minRangeSize = minRangeSize;
+        outParameters.maxRangeSize = maxRangeSize;
+        outParameters.iterationHint = iterationHint;
+    }
 
-                // transform color
-                context.destImage.WritePixel(x + context.rx0, ry, domain.TransformColor((uint8)domainPixelColor));
-            }
+    // channel layout
+    {
+        ByteReader reader(chunks.channels.data, chunks.channels.size);
+        uint8 storedNumChannels = 0, channelType = 0, channelSubsampling = 0;
+        if (!reader.ReadUint8(storedNumChannels) || storedNumChannels != numChannels ||
+            !reader.ReadUint8(channelType) || !reader.ReadUint8(channelSubsampling) ||
+            channelType >= (uint8)ChannelType::Count)
+        {
+            std::cout << "Corrupted file (channel layout)" << std::endl;
+            return false;
         }
+
+        outParameters.channelType = (ChannelType)channelType;
+        outParameters.channelSubsampling = channelSubsampling;
     }
+
+    return true;
 }
 
-bool Compressor::Decompress(Image& outImage) const
+bool Compressor::ReadRawQuadtree(const Chunk& chunk, const uint8*& outWords, uint32& outNumFlags)
 {
-    if (mDomains.empty())
+    ByteReader reader(chunk.data, chunk.size);
+    uint32 numFlags = 0;
+    if (!reader.ReadUint32(numFlags) ||
+        reader.GetRemainingSize() / sizeof(QuadtreeCode::ElementType) < ((uint64)numFlags + 31) / 32)
+    {
+        return false;
+    }
+
+    outWords = reader.GetPosition();
+    outNumFlags = numFlags;
+    return true;
+}
+
+bool Compressor::ReadRawDomains(const Chunk& chunk, const uint8*& outPackedDomains, uint32& outNumDomains)
+{
+    ByteReader reader(chunk.data, chunk.size);
+    uint32 numDomains = 0;
+    if (!reader.ReadUint32(numDomains) || reader.GetRemainingSize() / sizeof(uint32) < numDomains)
+    {
+        return false;
+    }
+
+    outPackedDomains = reader.GetPosition();
+    outNumDomains = numDomains;
+    return true;
+}
+
+bool Compressor::ReadRowIndex(const Chunk& chunk, const uint8*& outRows, uint32& outNumRows)
+{
+    ByteReader reader(chunk.data, chunk.size);
+    uint32 numRows = 0;
+    if (!reader.ReadUint32(numRows) ||
+        reader.GetRemainingSize() / sizeof(QuadtreeIndex::Row) < (uint64)numRows + 1)
+    {
+        return false;
+    }
+
+    outRows = reader.GetPosition();
+    outNumRows = numRows;
+    return true;
+}
+
+bool Compressor::LoadChannel(const ChannelChunks& chunks, uint32 numChannels)
+{
+    LoadedChannel channel;
+    if (!ReadChannel(chunks, numChannels, channel))
+    {
+        return false;
+    }
+
+    ApplyLoadedChannel(channel);
+    return true;
+}
+
+bool Compressor::ReadChannel(const ChannelChunks& chunks, uint32 numChannels, LoadedChannel& outChannel)
+{
+    ChannelParameters& parameters = outChannel.parameters;
+    if (!ReadParameters(chunks, numChannels, parameters))
     {
-        std::cout << "There is no encoded data" << std::endl;
         return false;
     }
 
-    const uint32 MAX_ITERATIONS = 100;
+    // quadtree
+    if (chunks.quadtree.data)
+    {
+        ByteReader reader(chunks.quadtree.data, chunks.quadtree.size);
+        uint32 numFlags = 0;
+        if (!reader.ReadUint32(numFlags) ||
+            !QuadtreeCoder::Decode(reader.GetPosition(), reader.GetRemainingSize(), parameters.imageSize, parameters.minRangeSize,
+                                   parameters.maxRangeSize, numFlags, outChannel.quadtreeCode))
+        {
+            std::cout << "Corrupted file (quadtree)" << std::endl;
+            return false;
+        }
+    }
+    else
+    {
+        const uint8* rawWords = nullptr;
+        uint32 numFlags = 0;
+        if (!ReadRawQuadtree(chunks.rawQuadtree, rawWords, numFlags))
+        {
+            std::cout << "Corrupted file (quadtree)" << std::endl;
+            return false;
+        }
 
-    uint32 currentImage = 0;
-    Image tempImages[2];
-    tempImages[0].Resize(mSize, 1);
-    tempImages[1].Resize(mSize, 1);
+        // the words are little-endian
+        std::vector<QuadtreeCode::ElementType> words((size_t)(((uint64)numFlags + 31) / 32));
+        ByteReader reader(rawWords, words.size() * sizeof(uint32));
+        for (QuadtreeCode::ElementType& word : words)
+        {
+            reader.ReadUint32(word);
+        }
+        outChannel.quadtreeCode.Load(std::move(words), numFlags);
+    }
 
-    QuadtreeCode tmpQuadtreeCode(mQuadtreeCode);
+    // the split flags are walked anyway (the data is validated when loaded), so the index is rebuilt
+    if (!outChannel.quadtreeIndex.Build(outChannel.quadtreeCode, parameters.imageSize, parameters.minRangeSize, parameters.maxRangeSize))
+    {
+        std::cout << "Corrupted file (quadtree)" << std::endl;
+        return false;
+    }
 
-    for (uint32 i = 0; i < MAX_ITERATIONS; ++i)
+    // the stored index (raw layout only) must match it
+    if (chunks.rowIndex.data)
     {
-        // swap images
-        currentImage ^= 1;
-        const Image& src = tempImages[currentImage ^ 1];
-        Image& dest = tempImages[currentImage];
+        const std::vector<QuadtreeIndex::Row>& rows = outChannel.quadtreeIndex.GetRows();
+        const uint8* storedRows = nullptr;
+        uint32 numStoredRows = 0;
+        bool valid = ReadRowIndex(chunks.rowIndex, storedRows, numStoredRows) && numStoredRows + 1 == (uint32)rows.size();
 
-        tmpQuadtreeCode.ResetCursor();
+        ByteReader reader(storedRows, valid ? rows.size() * sizeof(QuadtreeIndex::Row) : 0);
+        for (uint32 i = 0; valid && i < (uint32)rows.size(); ++i)
+        {
+            uint32 flagOffset = 0, domainIndex = 0;
+            reader.ReadUint32(flagOffset);
+            reader.ReadUint32(domainIndex);
+            valid = flagOffset == rows[i].flagOffset && domainIndex == rows[i].domainIndex;
+        }
 
-        // iterate through root domains
-        uint32 domainIndex = 0;
+        if (!valid)
+        {
+            std::cout << "Corrupted file (quadtree index)" << std::endl;
+            return false;
+        }
+    }
 
-        RangeDecompressContext context(src, dest, domainIndex, tmpQuadtreeCode);
-        context.rangeSize = mSettings.maxRangeSize;
+    // domains (every leaf of the quadtree has one domain - the count is checked before decoding)
+    if (chunks.domains.data)
+    {
+        ByteReader reader(chunks.domains.data, chunks.domains.size);
+        uint32 numDomains = 0;
+        uint8 flags = 0;
+        if (!reader.ReadUint32(numDomains) || !reader.ReadUint8(flags) || numDomains != outChannel.quadtreeIndex.GetNumDomains())
+        {
+            std::cout << "Corrupted file (domains)" << std::endl;
+            return false;
+        }
 
-        for (uint32 ry0 = 0; ry0 < mSize; ry0 += mSettings.maxRangeSize)
+        std::vector<DomainPrediction> predictions;
+        if (flags & DOMAINS_FLAG_PREDICTED_POSITIONS)
         {
-            for (uint32 rx0 = 0; rx0 < mSize; rx0 += mSettings.maxRangeSize)
+            if (!DomainCoder::PredictLocations(outChannel.quadtreeCode, parameters.imageSize, parameters.minRangeSize,
+                                               parameters.maxRangeSize, predictions))
             {
-                context.rx0 = rx0;
-                context.ry0 = ry0;
-                DecompressRange(context);
+                return false;
             }
         }
 
-        //assert(domainIndex == (uint32)mDomains.size());
+        if (!DomainCoder::Decode(reader.GetPosition(), reader.GetRemainingSize(), numDomains, predictions, outChannel.domains))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        const uint8* packedDomains = nullptr;
+        uint32 numDomains = 0;
+        if (!ReadRawDomains(chunks.rawDomains, packedDomains, numDomains) || numDomains != outChannel.quadtreeIndex.GetNumDomains())
+        {
+            std::cout << "Corrupted file (domains)" << std::endl;
+            return false;
+        }
+
+        ByteReader reader(packedDomains, numDomains * sizeof(uint32));
+        outChannel.domains.resize(numDomains);
+        for (Domain& domain : outChannel.domains)
+        {
+            uint32 packed = 0;
+            reader.ReadUint32(packed);
+            domain = Domain::Unpack(packed);
+        }
     }
 
-    outImage = std::move(tempImages[currentImage]);
     return true;
 }
 
+bool Compressor::ReadLegacy(const uint8* data, size_t size, LoadedChannel& outChannel)
+{
+    // the header is a raw structure (host byte order)
+    LegacyHeader header;
+    if (size < sizeof(LegacyHeader))
+    {
+        std::cout << "Corrupted/invalid file" << std::endl;
+        return false;
+    }
+    memcpy(&header, data, sizeof(LegacyHeader));
 
-//////////////////////////////////////////////////////////////////////////
-// Input-output
-//////////////////////////////////////////////////////////////////////////
+    if (header.magic != LEGACY_MAGIC)
+    {
+        std::cout << "Corrupted/invalid file" << std::endl;
+        return false;
+    }
 
-bool Compressor::Load(const std::string& name)
-{
-    FILE* file = fopen(name.c_str(), "rb");
-    if (!file)
+    if (header.numDomains == 0 ||
+        !IsValidGeometry(header.imageSize, header.settings.minRangeSize, header.settings.maxRangeSize))
     {
-        std::cout << "Failed to open compressed file '" << name << "': " << stderr << std::endl;
+        std::cout << "Corrupted file" << std::endl;
         return false;
     }
 
-    Header header;
-    if (fread(&header, sizeof(Header), 1, file) != 1)
+    // single grayscale channel, no iteration hint
+    ChannelParameters& parameters = outChannel.parameters;
+    parameters.imageSize = header.imageSize;
+    parameters.minRangeSize = header.settings.minRangeSize;
+    parameters.maxRangeSize = header.settings.maxRangeSize;
+    parameters.iterationHint = 0;
+    parameters.channelType = ChannelType::Gray;
+    parameters.channelSubsampling = 0;
+
+    ByteReader reader(data + sizeof(LegacyHeader), size - sizeof(LegacyHeader));
+    const uint8* payload = nullptr;
+
+    // read quadtree (calculate number of elements from number of bits - round up)
+    const uint64 quadtreeCodeElements = ((uint64)header.quadtreeDataSize + 8 * sizeof(QuadtreeCode::ElementType) - 1) / (8 * sizeof(QuadtreeCode::ElementType));
+    if (quadtreeCodeElements > reader.GetRemainingSize() / sizeof(QuadtreeCode::ElementType) ||
+        !reader.ReadBytes((size_t)quadtreeCodeElements * sizeof(QuadtreeCode::ElementType), payload))
     {
-        std::cout << "Failed to read compressed file header: " << stderr << std::endl;
-        fclose(file);
+        std::cout << "Failed to read quadtree data" << std::endl;
         return false;
     }
+    outChannel.quadtreeCode.Load(payload, header.quadtreeDataSize);
 
-    if (header.magic != HEADER_MAGIC)
+    // every leaf of the quadtree has one domain - the count is checked before allocating the domains
+    if (!outChannel.quadtreeIndex.Build(outChannel.quadtreeCode, parameters.imageSize, parameters.minRangeSize, parameters.maxRangeSize) ||
+        outChannel.quadtreeIndex.GetNumDomains() != header.numDomains)
     {
-        std::cout << "Corrupted/invalid file" << std::endl;
-        fclose(file);
+        std::cout << "Corrupted file (quadtree)" << std::endl;
         return false;
     }
 
-    if ((header.imageSize & (header.imageSize - 1)) != 0 || header.numDomains == 0)
+    // read domains (raw Domain structures, the bit fields match the packed form - see Domain::Pack)
+    if (reader.GetRemainingSize() / sizeof(uint32) < header.numDomains)
     {
-        std::cout << "Corrupted file" << std::endl;
+        std::cout << "Failed to read domains data" << std::endl;
+        return false;
+    }
+
+    outChannel.domains.resize(header.numDomains);
+    for (Domain& domain : outChannel.domains)
+    {
+        uint32 packed = 0;
+        reader.ReadUint32(packed);
+        domain = Domain::Unpack(packed);
+    }
+
+    return true;
+}
+
+void Compressor::ApplyLoadedChannel(LoadedChannel& channel)
+{
+    for (std::shared_ptr<const DecodePlan>& plan : mDecodePlans)
+    {
+        plan.reset();
+    }
+
+    const ChannelParameters& parameters = channel.parameters;
+    SetGeometry(parameters.imageSize, parameters.minRangeSize, parameters.maxRangeSize);
+    mIterationHint = parameters.iterationHint;
+    mSettings.channelType = parameters.channelType;
+    mSettings.channelSubsampling = parameters.channelSubsampling;
+
+    mQuadtreeCode = std::move(channel.quadtreeCode);
+    mQuadtreeIndex = std::move(channel.quadtreeIndex);
+    mDomains = std::move(channel.domains);
+}
+
+bool Compressor::IsValidGeometry(uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize)
+{
+    const auto isPowerOfTwo = [](uint32 x) { return x != 0 && (x & (x - 1)) == 0; };
+
+    if (!isPowerOfTwo(imageSize) || !isPowerOfTwo(minRangeSize) || !isPowerOfTwo(maxRangeSize) ||
+        minRangeSize <= 2 || maxRangeSize < minRangeSize || maxRangeSize > imageSize || maxRangeSize > 128)
+    {
+        std::cout << "Corrupted/invalid file (image size " << imageSize << ", range sizes " << minRangeSize << "-" << maxRangeSize << ")" << std::endl;
         return false;
     }
 
-    // read file size
-    mSize = header.imageSize;
+    return true;
+}
+
+void Compressor::SetGeometry(uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize)
+{
+    mSettings.minRangeSize = (uint8)minRangeSize;
+    mSettings.maxRangeSize = (uint8)maxRangeSize;
+
+    mSize = imageSize;
     mSizeBits = 0;
     {
         uint32 i = mSize;
         while (i >>= 1) ++mSizeBits;
     }
     mSizeMask = (1 << mSizeBits) - 1;
+}
 
-    if (mSettings.minRangeSize <= 2 || mSettings.maxRangeSize < mSettings.minRangeSize)
+bool Compressor::EncodeDomains(std::vector<uint8>& outData, bool& outPredictedPositions) const
+{
+    outPredictedPositions = false;
+    if (!DomainCoder::Encode(mDomains, std::vector<DomainPrediction>(), outData))
     {
-        std::cout << "Corrupted/invalid file" << std::endl;
-        fclose(file);
         return false;
     }
 
-    // calculate number of elements from number of bits (round up)
-    const uint32 quadtreeCodeElements = (header.quadtreeDataSize + 8 * sizeof(QuadtreeCode::ElementType) - 1) / (8 * sizeof(QuadtreeCode::ElementType));
-    if (quadtreeCodeElements > 0)
+    // relative locations pay off only if domains are found around their ranges, keep the smaller variant
+    if (mSettings.predictDomainPositions)
     {
-        std::vector<QuadtreeCode::ElementType> code;
-        code.resize(quadtreeCodeElements);
-        if (fread(code.data(), quadtreeCodeElements * sizeof(QuadtreeCode::ElementType), 1, file) != 1)
+        std::vector<DomainPrediction> predictions;
+        std::vector<uint8> predictedData;
+        if (!DomainCoder::PredictLocations(mQuadtreeCode, mSize, mSettings.minRangeSize, mSettings.maxRangeSize, predictions) ||
+            !DomainCoder::Encode(mDomains, predictions, predictedData))
         {
-            std::cout << "Failed to read quadtree data: " << stderr << std::endl;
-            fclose(file);
             return false;
         }
-        mQuadtreeCode.Load(code, header.quadtreeDataSize);
-    }
-    else
-    {
-        mQuadtreeCode.Clear();
+
+        if (predictedData.size() < outData.size())
+        {
+            outData.swap(predictedData);
+            outPredictedPositions = true;
+        }
     }
 
-    // read domains
-    mDomains.resize(header.numDomains);
-    if (fread(mDomains.data(), mDomains.size() * sizeof(Domain), 1, file) != 1)
+    return true;
+}
+
+bool Compressor::Save(const std::string& name) const
+{
+    ContainerWriter container;
+    if (!WriteChannel(container, 1))
     {
-        std::cout << "Failed to read domains data: " << stderr << std::endl;
-        fclose(file);
         return false;
     }
 
-    fclose(file);
-    return true;
+    return WriteFileData(name, container.Finish());
 }
 
-bool Compressor::Save(const std::string& name) const
+bool Compressor::SaveRaw(const std::string& name) const
 {
-    FILE* file = fopen(name.c_str(), "wb");
-    if (!file)
+    ContainerWriter container;
+    if (!WriteChannel(container, 1, true))
     {
-        std::cout << "Failed to open target encoded file '" << name << "': " << stderr << std::endl;
         return false;
     }
 
-    Header header;
-    header.magic = HEADER_MAGIC;
-    header.imageSize = mSize;
-    header.quadtreeDataSize = mQuadtreeCode.GetSize();
-    header.numDomains = (uint32)mDomains.size();
-    header.settings = mSettings;
+    return WriteFileData(name, container.Finish());
+}
 
-    if (fwrite(&header, sizeof(Header), 1, file) != 1)
+bool Compressor::WriteChannel(ContainerWriter& container, uint32 numChannels, bool raw) const
+{
+    if (mDomains.empty())
     {
-        std::cout << "Failed to write compressed file header: " << stderr << std::endl;
-        fclose(file);
+        std::cout << "There is no encoded data" << std::endl;
         return false;
     }
 
-    if (mQuadtreeCode.GetNumElements() > 0)
+    std::vector<uint8> quadtreeData;
+    std::vector<uint8> domainData;
+    bool predictedPositions = false;
+    if (!raw)
     {
-        if (fwrite(mQuadtreeCode.GetCode().data(), mQuadtreeCode.GetNumElements() * sizeof(QuadtreeCode::ElementType), 1, file) != 1)
+        if (!QuadtreeCoder::Encode(mQuadtreeCode, mSize, mSettings.minRangeSize, mSettings.maxRangeSize, quadtreeData) ||
+            !EncodeDomains(domainData, predictedPositions))
         {
-            std::cout << "Failed to write quadtree data: " << stderr << std::endl;
-            fclose(file);
             return false;
         }
     }
 
-    if (fwrite(mDomains.data(), mDomains.size() * sizeof(Domain), 1, file) != 1)
+    container.BeginChunk(CHUNK_PARAMETERS);
+    container.WriteUint32(mSize);
+    container.WriteUint8(mSettings.minRangeSize);
+    container.WriteUint8(mSettings.maxRangeSize);
+    container.WriteUint8(DOMAIN_LOCATION_BITS);
+    container.WriteUint8(DOMAIN_TRANSFORM_BITS);
+    container.WriteUint8(DOMAIN_OFFSET_BITS);
+    container.WriteUint8(DOMAIN_OFFSET_RANGE_BITS);
+    container.WriteUint8(DOMAIN_SCALE_BITS);
+    container.WriteUint8(DOMAIN_SCALE_RANGE_BITS);
+    container.WriteUint16((uint16)std::min<uint32>(mIterationHint, 0xFFFF));
+    container.EndChunk();
+
+    container.BeginChunk(CHUNK_CHANNELS);
+    container.WriteUint8((uint8)numChannels);
+    container.WriteUint8((uint8)mSettings.channelType);
+    container.WriteUint8(mSettings.channelSubsampling);
+    container.EndChunk();
+
+    if (raw)
     {
-        std::cout << "Failed to write domains data: " << stderr << std::endl;
-        fclose(file);
-        return false;
+        // the words are aligned, so they can be referenced in a mapped file
+        const uint32 numFlags = mQuadtreeCode.GetSize();
+        container.BeginChunk(CHUNK_QUADTREE_RAW, sizeof(uint32));
+        container.WriteUint32(numFlags);
+        for (uint32 i = 0; i < (numFlags + 31) / 32; ++i)
+        {
+            // bits past the end of the code may be set (see QuadtreeCode::Load)
+            QuadtreeCode::ElementType word = mQuadtreeCode.GetCode()[i];
+            if (numFlags - 32 * i < 32)
+            {
+                word &= ((QuadtreeCode::ElementType)1 << (numFlags - 32 * i)) - 1;
+            }
+            container.WriteUint32(word);
+        }
+        container.EndChunk();
+
+        container.BeginChunk(CHUNK_DOMAINS_RAW, sizeof(uint32));
+        container.WriteUint32((uint32)mDomains.size());
+        for (const Domain& domain : mDomains)
+        {
+            container.WriteUint32(domain.Pack());
+        }
+        container.EndChunk();
+
+        // rows of root ranges can be located without walking the split flags
+        if (mQuadtreeIndex.GetNumRows() > 0)
+        {
+            container.BeginChunk(CHUNK_ROW_INDEX, sizeof(uint32));
+            container.WriteUint32(mQuadtreeIndex.GetNumRows());
+            for (const QuadtreeIndex::Row& row : mQuadtreeIndex.GetRows())
+            {
+                container.WriteUint32(row.flagOffset);
+                container.WriteUint32(row.domainIndex);
+            }
+            container.EndChunk();
+        }
+    }
+    else
+    {
+        const size_t totalSize = quadtreeData.size() + domainData.size();
+        const float bitsPerPixel = (float)(totalSize * 8) / (float)(mSize * mSize);
+        std::cout << "Quadtree size:   " << mQuadtreeCode.GetSize() << " flags, " << quadtreeData.size() << " bytes" << std::endl;
+        std::cout << "Domains size:    " << domainData.size() << " bytes" << (predictedPositions ? " (relative locations)" : "") << std::endl;
+        std::cout << "Compressed size: " << totalSize << " bytes (" << std::setw(8) << std::setprecision(4) << bitsPerPixel << " bpp)" << std::endl;
+
+        container.BeginChunk(CHUNK_QUADTREE);
+        container.WriteUint32(mQuadtreeCode.GetSize());
+        container.WriteBytes(quadtreeData.data(), quadtreeData.size());
+        container.EndChunk();
+
+        container.BeginChunk(CHUNK_DOMAINS);
+        container.WriteUint32((uint32)mDomains.size());
+        container.WriteUint8(predictedPositions ? DOMAINS_FLAG_PREDICTED_POSITIONS : 0);
+        container.WriteBytes(domainData.data(), domainData.size());
+        container.EndChunk();
     }
 
-    fclose(file);
     return true;
 }
 
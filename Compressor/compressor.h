@@ -4,11 +4,25 @@
 #include "domain.h"
 #include "image.h"
 #include "quadtree.h"
+#include "quadtree_index.h"
+#include "telemetry.h"
+#include "decode_plan.h"
+#include "decoder.h"
+#include "thread_pool.h"
 
-#include <Windows.h>
 #include <vector>
 #include <string>
 #include <mutex>
+#include <memory>
+
+class ContainerWriter;
+
+// compressed files smaller than this are read rather than memory mapped (see MappedFile)
+#define COMPRESSOR_MAPPED_FILE_MIN_SIZE (64 * 1024)
+
+// encoder threads wait once they get this many root ranges (per thread) ahead of the oldest unfinished one,
+// so the finished root ranges waiting for it in the reorder buffer take bounded memory
+#define COMPRESSOR_REORDER_WINDOW_PER_THREAD 2
 
 
 //////////////////////////////////////////////////////////////////////////
@@ -25,8 +39,12 @@ struct RangeContext
     std::vector<uint8>& rangeDataCache;
     std::vector<uint8>& domainDataCache;
 
-    RangeContext(const Image& image, std::vector<uint8>& rangeDataCache, std::vector<uint8>& domainDataCache)
-        : image(image), rangeDataCache(rangeDataCache), domainDataCache(domainDataCache)
+    // per-thread telemetry counters
+    EncoderThreadStats& stats;
+
+    RangeContext(const Image& image, std::vector<uint8>& rangeDataCache, std::vector<uint8>& domainDataCache,
+                 EncoderThreadStats& stats)
+        : image(image), rangeDataCache(rangeDataCache), domainDataCache(domainDataCache), stats(stats)
     { }
 
     RangeContext(const RangeContext&) = default;
@@ -41,26 +59,24 @@ struct DomainMatchParams
     
     uint8 transform;
 
+    // matching is aborted as soon as the error exceeds this value
+    float maxCost;
+
     DomainMatchParams(const RangeContext& rangeContext)
         : rangeContext(rangeContext)
+        , maxCost(FLT_MAX)
     { }
 };
 
-struct RangeDecompressContext
+// image channel stored in the compressed file
+enum class ChannelType : uint8
 {
-    uint32 rx0, ry0;
-    uint32 rangeSize;
-    uint32& domainIndex;
-    QuadtreeCode& quadtreeCode;
-    const Image& srcImage;
-    Image& destImage;
-
-    RangeDecompressContext(const Image& srcImage, Image& destImage,
-                               uint32& domainIndex, QuadtreeCode& quadtreeCode)
-        : srcImage(srcImage), destImage(destImage), domainIndex(domainIndex), quadtreeCode(quadtreeCode)
-    { }
+    Gray,
+    Luma,           // Y
+    ChromaBlue,     // Cb
+    ChromaRed,      // Cr
 
-    RangeDecompressContext(const RangeDecompressContext&) = default;
+    Count
 };
 
 struct CompressorSettings
@@ -70,37 +86,200 @@ struct CompressorSettings
     uint8 maxRangeSize;
     bool disableImportance;
 
+    // allow coding domain locations relative to their range blocks (used if smaller)
+    // and prefer domains closer to the range on equal match cost
+    bool predictDomainPositions;
+
+    // channel layout (stored in the compressed file)
+    // the channel was downsampled 2^channelSubsampling times before compression
+    ChannelType channelType;
+    uint8 channelSubsampling;
+
+    // decode the image after compression to store the number of iterations as a hint for decoders
+    // (a full decompression, so it's off by default)
+    bool computeIterationHint;
+
     CompressorSettings()
         : mseMultiplier(1.0f)
         , minRangeSize(4)
         , maxRangeSize(32)
         , disableImportance(false)
+        , predictDomainPositions(true)
+        , channelType(ChannelType::Gray)
+        , channelSubsampling(0)
+        , computeIterationHint(false)
     { }
 };
 
+// finished root range block of the encoder
+struct EncodedRootRange
+{
+    // index of the root range in the raster order, and its location
+    uint32 index;
+    uint32 rx0, ry0;
+
+    // split flags and domains of the quadtree leaves (in the quadtree order)
+    const QuadtreeCode* quadtreeCode;
+    const Domain* domains;
+    uint32 numDomains;
+};
+
+/**
+* Receiver of the encoder output, so it can be written out (or sent) before the whole image is encoded.
+* Root ranges are delivered in the raster order, one at a time, from the encoder threads.
+* NOTE: a slow sink holds back the other encoder threads (they can't run more than
+* COMPRESSOR_REORDER_WINDOW_PER_THREAD root ranges per thread ahead of the sink).
+*/
+class EncoderSink
+{
+public:
+    virtual ~EncoderSink() { }
+
+    // called before any root range, with the image geometry (image size and range sizes)
+    virtual bool Begin(uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize)
+    {
+        (void)imageSize; (void)minRangeSize; (void)maxRangeSize;
+        return true;
+    }
+
+    // finished root range (in the raster order), returning false aborts the compression
+    virtual bool OnRootRange(const EncodedRootRange& rootRange) = 0;
+
+    // called after the last root range
+    virtual bool End()
+    {
+        return true;
+    }
+};
+
 class Compressor
 {
 public:
     Compressor(const CompressorSettings& settings = CompressorSettings());
 
     // load compressed image from a file
-    bool Load(const std::string& name);
+    // the range sizes and the channel layout are restored from the file
+    // 'channelIndex' selects the channel of multi-channel files (see ColorCompressor)
+    // NOTE: the compressed image is not modified if the file can't be loaded
+    bool Load(const std::string& name, uint32 channelIndex = 0);
+
+    // load compressed image from memory (e.g. file mapped by the caller), the data is not referenced afterwards
+    bool Load(const uint8* data, size_t size, uint32 channelIndex = 0);
 
     // save compressed image to a file
     bool Save(const std::string& name) const;
 
+    // save compressed image in the raw layout: split flags and domains are stored as aligned 32-bit words
+    // (not entropy coded), so the file can be decoded in place without loading it (see CompressedImageView)
+    // the row index is stored as well, so rows of root ranges can be located without walking the split flags
+    // NOTE: the file is bigger than the one written by Save(), whose entropy coded streams are not seekable
+    bool SaveRaw(const std::string& name) const;
+
     // save compressed image as C file
     bool SaveAsSourceFile(const std::string& prefix, const std::string& name) const;
 
     // compress an image
-    bool Compress(const Image& image);
+    // optionally, fills encoder telemetry (counters and phase timings)
+    // and streams finished root ranges to 'sink' (see EncoderSink)
+    bool Compress(const Image& image, EncoderTelemetry* outTelemetry = nullptr, EncoderSink* sink = nullptr);
+
+    // compress an image, streaming finished root ranges to 'sink' only
+    // the compressed data is not kept (it can't be saved or decompressed afterwards), so the encoder
+    // output takes memory only while it's waiting in the reorder buffer
+    // telemetry does not include domain stats
+    bool CompressToSink(const Image& image, EncoderSink& sink, EncoderTelemetry* outTelemetry = nullptr);
 
     // decompress an image
-    bool Decompress(Image& outImage) const;
+    // optionally, returns number of performed iterations and final pixel change
+    // NOTE: uses a temporary decoder - repeated or concurrent decoding should use GetDecodePlan()
+    // with a Decoder per thread, which reuses its buffers
+    bool Decompress(Image& outImage, const DecompressionSettings& settings = DecompressionSettings(),
+                    DecompressionStats* outStats = nullptr) const;
+
+    // decompress only a region of an image (in the decoded image coordinates)
+    // only range blocks which influence the region (directly or via their domains) are decoded, pixels
+    // outside of the region are undefined; falls back to full decompression if the region depends
+    // on (almost) the whole image
+    bool DecompressRegion(uint32 x, uint32 y, uint32 width, uint32 height, Image& outImage,
+                          const DecompressionSettings& settings = DecompressionSettings(),
+                          DecompressionStats* outStats = nullptr) const;
+
+    // get decode plan of the compressed image (built on the first use and reused by consecutive decodes)
+    // returns null if the compressed data is invalid or the resolution is not supported
+    // 'numThreads' - threads building the plan (0 - all the hardware threads), rows of root ranges are built in parallel
+    // NOTE: thread-safe, the plan is immutable and stays valid even if the compressor is modified or destroyed
+    std::shared_ptr<const DecodePlan> GetDecodePlan(int32 resolutionShift = 0, uint32 numThreads = 1) const;
+
+    const CompressorSettings& GetSettings() const
+    {
+        return mSettings;
+    }
+
+    // number of iterations the encoder needed to converge with the default decompression settings
+    // (0 if unknown - e.g. files written by older versions)
+    uint32 GetIterationHint() const
+    {
+        return mIterationHint;
+    }
 
 private:
+    // benchmarks measure internal kernels directly
+    friend class CompressorBenchmark;
+
+    // stores multiple channels in one file
+    friend class ColorCompressor;
+
+    // parses the container in place
+    friend class CompressedImageView;
+
+    // chunk payload within the compressed file data (null if missing)
+    struct Chunk
+    {
+        const uint8* data;
+        uint32 size;
+
+        Chunk()
+            : data(nullptr), size(0)
+        { }
+    };
+
+    // chunks of a single channel, every channel is a section of the container starting with the parameters chunk
+    struct ChannelChunks
+    {
+        Chunk parameters;
+        Chunk channels;
+        Chunk quadtree;
+        Chunk domains;
+
+        // raw layout (see SaveRaw), stored instead of the entropy coded chunks
+        Chunk rawQuadtree;
+        Chunk rawDomains;
+        Chunk rowIndex;     // optional
+    };
+
+    // codec parameters and channel layout of a channel section
+    struct ChannelParameters
+    {
+        uint32 imageSize;
+        uint32 minRangeSize;
+        uint32 maxRangeSize;
+        uint32 iterationHint;
+        ChannelType channelType;
+        uint8 channelSubsampling;
+    };
+
+    // channel decoded from a file, applied to the compressor only when the whole file is valid
+    struct LoadedChannel
+    {
+        ChannelParameters parameters;
+        QuadtreeCode quadtreeCode;
+        QuadtreeIndex quadtreeIndex;
+        std::vector<Domain> domains;
+    };
+
     // Calculate range block vs. domain block similarity.
     // Returns best MSE + intensity scaling and offset values
+    // (or any value above params.maxCost if matching was aborted early)
     float MatchDomain(const DomainMatchParams& params,
                       uint8 rangeSize, float& outScale, float& outOffset) const;
 
@@ -113,12 +292,57 @@ private:
     uint32 CompressRootRange(const RangeContext& rangeContext,
                              QuadtreeCode& outQuadtreeCode, std::vector<Domain>& outDomains) const;
 
-    // decompress root range (this will be called recursively)
-    void DecompressRange(const RangeDecompressContext& context) const;
-
     DomainsStats CalculateDomainStats() const;
 
-    mutable std::mutex mMutex;
+    // compress an image, root ranges are passed to 'sink' and (if 'keepOutput') to the compressed data
+    bool Encode(const Image& image, EncoderTelemetry* outTelemetry, EncoderSink* sink, bool keepOutput);
+
+    // split file in the chunked container format (see ContainerWriter) into channel sections
+    // 'verifyChecksum' - see ContainerReader
+    static bool ReadChannels(const uint8* data, size_t size, std::vector<ChannelChunks>& outChannels, bool verifyChecksum = true);
+
+    // read and validate parameters of a channel section of a container with 'numChannels' channels
+    static bool ReadParameters(const ChannelChunks& chunks, uint32 numChannels, ChannelParameters& outParameters);
+
+    // raw split flags and packed domains (see SaveRaw), the words are little-endian and follow the count
+    static bool ReadRawQuadtree(const Chunk& chunk, const uint8*& outWords, uint32& outNumFlags);
+    static bool ReadRawDomains(const Chunk& chunk, const uint8*& outPackedDomains, uint32& outNumDomains);
+
+    // stored index of the raw layout: 'outNumRows' rows and the terminating entry, pairs of little-endian words
+    // (first split flag, first domain - see QuadtreeIndex::Row)
+    static bool ReadRowIndex(const Chunk& chunk, const uint8*& outRows, uint32& outNumRows);
+
+    // load single channel section of a container with 'numChannels' channels
+    // NOTE: the compressor is not modified if the section is invalid
+    bool LoadChannel(const ChannelChunks& chunks, uint32 numChannels);
+
+    // decode single channel section of a container with 'numChannels' channels
+    static bool ReadChannel(const ChannelChunks& chunks, uint32 numChannels, LoadedChannel& outChannel);
+
+    // append channel section to the container ('raw' - see SaveRaw)
+    bool WriteChannel(ContainerWriter& container, uint32 numChannels, bool raw = false) const;
+
+    // decode file with the raw header structure
+    static bool ReadLegacy(const uint8* data, size_t size, LoadedChannel& outChannel);
+
+    // replace the compressed image with a decoded one (the channel is moved from)
+    void ApplyLoadedChannel(LoadedChannel& channel);
+
+    // validate image geometry of a loaded file
+    static bool IsValidGeometry(uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize);
+
+    // apply valid image geometry (see IsValidGeometry)
+    void SetGeometry(uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize);
+
+    // entropy code the domains (as stored in the compressed file)
+    // 'outPredictedPositions' is set if domain locations are coded relative to their range blocks
+    bool EncodeDomains(std::vector<uint8>& outData, bool& outPredictedPositions) const;
+
+    // guards encoder progress output and the root ranges reorder buffer
+    mutable std::mutex mEncoderMutex;
+
+    // guards mDecodePlans and mPlanThreadPool, so decoding threads don't wait for the encoder
+    mutable std::mutex mDecodePlansMutex;
 
     // Image info
     uint32 mSize;
@@ -127,10 +351,20 @@ private:
 
     // Compression info
     CompressorSettings mSettings;
+    uint32 mIterationHint;
 
     using Domains = std::vector<Domain>;
 
     // compressed data
     QuadtreeCode mQuadtreeCode;
     Domains mDomains;
+
+    // first split flag and domain of every row of root ranges
+    QuadtreeIndex mQuadtreeIndex;
+
+    // compiled compressed data for every decoding resolution (guarded by mDecodePlansMutex)
+    mutable std::shared_ptr<const DecodePlan> mDecodePlans[DECODE_NUM_RESOLUTIONS];
+
+    // workers for parallel plan building, created on first use (guarded by mDecodePlansMutex)
+    mutable std::unique_ptr<ThreadPool> mPlanThreadPool;
 };
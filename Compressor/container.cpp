@@ -0,0 +1,244 @@
+#include "container.h"
+
+#include <iostream>
+#include <stdio.h>
+#include <assert.h>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// CRC-32 (IEEE 802.3 polynomial)
+uint32 CalculateChecksum(const uint8* data, size_t size)
+{
+    static const struct Table
+    {
+        uint32 values[256];
+
+        Table()
+        {
+            for (uint32 i = 0; i < 256; ++i)
+            {
+                uint32 crc = i;
+                for (uint32 j = 0; j < 8; ++j)
+                {
+                    crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0u);
+                }
+                values[i] = crc;
+            }
+        }
+    } table;
+
+    uint32 crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+ContainerWriter::ContainerWriter()
+    : mChunkStart(0)
+{
+    WriteUint32(CONTAINER_MAGIC);
+    WriteUint16(CONTAINER_VERSION);
+    WriteUint16(0);
+}
+
+void ContainerWriter::BeginChunk(uint32 tag, uint32 payloadAlignment)
+{
+    assert(mChunkStart == 0);
+    assert(payloadAlignment > 0);
+
+    // the payload follows the tag and size fields of this chunk (and the padding chunk's, if inserted)
+    const size_t headerSize = 2 * sizeof(uint32);
+    if ((mData.size() + headerSize) % payloadAlignment != 0)
+    {
+        const size_t paddingSize = (payloadAlignment - (mData.size() + 2 * headerSize) % payloadAlignment) % payloadAlignment;
+        WriteUint32(CONTAINER_PADDING_TAG);
+        WriteUint32((uint32)paddingSize);
+        mData.resize(mData.size() + paddingSize, 0);
+    }
+
+    WriteUint32(tag);
+    mChunkStart = mData.size();
+    WriteUint32(0); // payload size, filled by EndChunk()
+}
+
+void ContainerWriter::EndChunk()
+{
+    assert(mChunkStart != 0);
+    const uint32 payloadSize = (uint32)(mData.size() - mChunkStart - sizeof(uint32));
+    for (uint32 i = 0; i < 4; ++i)
+    {
+        mData[mChunkStart + i] = (uint8)(payloadSize >> (8 * i));
+    }
+    mChunkStart = 0;
+}
+
+const std::vector<uint8>& ContainerWriter::Finish()
+{
+    assert(mChunkStart == 0);
+    const uint32 checksum = CalculateChecksum(mData.data(), mData.size());
+    BeginChunk(CONTAINER_CHECKSUM_TAG);
+    WriteUint32(checksum);
+    EndChunk();
+    return mData;
+}
+
+void ContainerWriter::WriteUint8(uint8 value)
+{
+    mData.push_back(value);
+}
+
+void ContainerWriter::WriteUint16(uint16 value)
+{
+    mData.push_back((uint8)value);
+    mData.push_back((uint8)(value >> 8));
+}
+
+void ContainerWriter::WriteUint32(uint32 value)
+{
+    for (uint32 i = 0; i < 4; ++i)
+    {
+        mData.push_back((uint8)(value >> (8 * i)));
+    }
+}
+
+void ContainerWriter::WriteBytes(const uint8* data, size_t size)
+{
+    mData.insert(mData.end(), data, data + size);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool ByteReader::ReadUint8(uint8& outValue)
+{
+    if (mEnd - mData < 1)
+    {
+        return false;
+    }
+
+    outValue = *mData++;
+    return true;
+}
+
+bool ByteReader::ReadUint16(uint16& outValue)
+{
+    if (mEnd - mData < 2)
+    {
+        return false;
+    }
+
+    outValue = (uint16)(mData[0] | (mData[1] << 8));
+    mData += 2;
+    return true;
+}
+
+bool ByteReader::ReadUint32(uint32& outValue)
+{
+    if (mEnd - mData < 4)
+    {
+        return false;
+    }
+
+    outValue = (uint32)mData[0] | ((uint32)mData[1] << 8) | ((uint32)mData[2] << 16) | ((uint32)mData[3] << 24);
+    mData += 4;
+    return true;
+}
+
+bool ByteReader::ReadBytes(size_t size, const uint8*& outData)
+{
+    if ((size_t)(mEnd - mData) < size)
+    {
+        return false;
+    }
+
+    outData = mData;
+    mData += size;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ContainerReader::ContainerReader(const uint8* data, size_t size, bool verifyChecksum)
+    : mData(data)
+    , mReader(data, size)
+    , mVersion(0)
+    , mVerifyChecksum(verifyChecksum)
+    , mCorrupted(false)
+{ }
+
+bool ContainerReader::ReadHeader()
+{
+    uint32 magic = 0;
+    uint16 reserved = 0;
+    if (!mReader.ReadUint32(magic) || !mReader.ReadUint16(mVersion) || !mReader.ReadUint16(reserved) ||
+        magic != CONTAINER_MAGIC)
+    {
+        std::cout << "Corrupted/invalid file" << std::endl;
+        return false;
+    }
+
+    if (mVersion == 0 || mVersion > CONTAINER_VERSION)
+    {
+        std::cout << "Unsupported file version " << mVersion << " (supported up to " << CONTAINER_VERSION << ")" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool ContainerReader::NextChunk(uint32& outTag, const uint8*& outPayload, uint32& outPayloadSize)
+{
+    const uint8* chunkStart = mReader.GetPosition();
+    if (!mReader.ReadUint32(outTag) || !mReader.ReadUint32(outPayloadSize) ||
+        !mReader.ReadBytes(outPayloadSize, outPayload))
+    {
+        // truncated chunk, or the data ended without the checksum
+        mCorrupted = true;
+        return false;
+    }
+
+    if (outTag == CONTAINER_CHECKSUM_TAG)
+    {
+        // the checksum closes the container
+        ByteReader checksumReader(outPayload, outPayloadSize);
+        uint32 checksum = 0;
+        if (!checksumReader.ReadUint32(checksum) || mReader.GetRemainingSize() != 0 ||
+            (mVerifyChecksum && checksum != CalculateChecksum(mData, (size_t)(chunkStart - mData))))
+        {
+            mCorrupted = true;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool WriteFileData(const std::string& name, const std::vector<uint8>& data)
+{
+    FILE* file = fopen(name.c_str(), "wb");
+    if (!file)
+    {
+        std::cout << "Failed to open target encoded file '" << name << "': " << stderr << std::endl;
+        return false;
+    }
+
+    if (fwrite(data.data(), data.size(), 1, file) != 1)
+    {
+        std::cout << "Failed to write compressed file: " << stderr << std::endl;
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+    return true;
+}
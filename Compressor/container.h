@@ -0,0 +1,131 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+#include <string>
+
+
+// chunk tag from four characters (stored in this order in the file)
+#define CONTAINER_TAG(a, b, c, d) ((uint32)(uint8)(a) | ((uint32)(uint8)(b) << 8) | ((uint32)(uint8)(c) << 16) | ((uint32)(uint8)(d) << 24))
+
+// file signature (the first four bytes)
+#define CONTAINER_MAGIC CONTAINER_TAG('I', 'C', 'F', 'C')
+
+// container format version, files with a newer version are rejected
+#define CONTAINER_VERSION 1
+
+// the last chunk - CRC-32 of all the preceding bytes
+#define CONTAINER_CHECKSUM_TAG CONTAINER_TAG('C', 'S', 'U', 'M')
+
+// filler in front of a chunk with aligned payload (skipped by readers like any unknown chunk)
+#define CONTAINER_PADDING_TAG CONTAINER_TAG('P', 'A', 'D', ' ')
+
+//////////////////////////////////////////////////////////////////////////
+
+/**
+* Writer of the chunked container.
+* Layout (all integers little-endian, independent of the host):
+*   magic (4 bytes), version (uint16), reserved (uint16),
+*   chunks: tag (4 bytes), payload size (uint32), payload
+*   checksum chunk (CONTAINER_CHECKSUM_TAG)
+* Readers skip unknown chunks, so new chunks can be added without breaking older decoders.
+* Payloads can be aligned (relative to the container start), so they can be referenced in place
+* when the container is loaded to aligned memory (e.g. mapped).
+*/
+class ContainerWriter
+{
+public:
+    ContainerWriter();
+
+    // start a new chunk, it's closed by EndChunk()
+    // the payload starts at a multiple of 'payloadAlignment' bytes (a padding chunk is inserted if needed)
+    void BeginChunk(uint32 tag, uint32 payloadAlignment = 1);
+    void EndChunk();
+
+    void WriteUint8(uint8 value);
+    void WriteUint16(uint16 value);
+    void WriteUint32(uint32 value);
+    void WriteBytes(const uint8* data, size_t size);
+
+    // append the checksum chunk and return the container data
+    const std::vector<uint8>& Finish();
+
+private:
+    std::vector<uint8> mData;
+    size_t mChunkStart; // offset of the open chunk's size field (0 if no chunk is open)
+};
+
+/**
+* Bounds-checked little-endian reader of a memory block (file or chunk payload).
+* Reads past the end fail and leave the value untouched.
+*/
+class ByteReader
+{
+public:
+    ByteReader(const uint8* data, size_t size)
+        : mData(data), mEnd(data + size)
+    { }
+
+    bool ReadUint8(uint8& outValue);
+    bool ReadUint16(uint16& outValue);
+    bool ReadUint32(uint32& outValue);
+
+    // skip 'size' bytes, returns pointer to them
+    bool ReadBytes(size_t size, const uint8*& outData);
+
+    size_t GetRemainingSize() const
+    {
+        return (size_t)(mEnd - mData);
+    }
+
+    const uint8* GetPosition() const
+    {
+        return mData;
+    }
+
+private:
+    const uint8* mData;
+    const uint8* mEnd;
+};
+
+/**
+* Reader of the chunked container (see ContainerWriter).
+* NOTE: chunk payloads point into the source memory, nothing is copied.
+*/
+class ContainerReader
+{
+public:
+    // 'verifyChecksum' - calculate the checksum of the data (the checksum chunk is required either way)
+    // without it, only the chunk structure is validated and the payloads are not touched
+    ContainerReader(const uint8* data, size_t size, bool verifyChecksum = true);
+
+    // validate the magic and the version
+    bool ReadHeader();
+
+    uint16 GetVersion() const
+    {
+        return mVersion;
+    }
+
+    // get the next chunk, returns false at the end of the data (or if the data is corrupted - see IsCorrupted())
+    // the checksum chunk is verified (if enabled), but not returned
+    bool NextChunk(uint32& outTag, const uint8*& outPayload, uint32& outPayloadSize);
+
+    bool IsCorrupted() const
+    {
+        return mCorrupted;
+    }
+
+private:
+    const uint8* mData;
+    ByteReader mReader;
+    uint16 mVersion;
+    bool mVerifyChecksum;
+    bool mCorrupted;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// write memory block to a file (single write call)
+bool WriteFileData(const std::string& name, const std::vector<uint8>& data);
@@ -0,0 +1,314 @@
+#pragma once
+
+// SIMD (SSSE3) fractal decoding kernels specialized for range block size and domain transform.
+// NOTE: this header is shared with the demo, so it uses the types (uint8, uint32, etc.) and
+// FORCE_INLINE macro defined by the includer.
+
+#include "settings.h"
+
+#include <tmmintrin.h>
+#include <string.h>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+#define DECODE_KERNEL_MIN_RANGE_SIZE    4
+#define DECODE_KERNEL_MAX_RANGE_SIZE    128
+
+/**
+* Decodes single range block: samples (with 2x2 downsampling) the domain block located at
+* (domainX, domainY), maps it with the transform, applies color scale and offset and
+* writes the result to the range block located at (rx0, ry0) of 'dest' image.
+* 'src' and 'dest' can point to the same image (in-place decoding).
+*
+* The domain block must not wrap around the image edges (domainX + 2 * rangeSize <= imageSize).
+*
+* Returns maximum absolute change of the range block pixels and adds sum of the changes to 'deltaSum'.
+*/
+using DecodeKernel = uint32 (*)(const uint8* src, uint8* dest, uint32 imageSize,
+                                uint32 rx0, uint32 ry0, uint32 domainX, uint32 domainY,
+                                int32 scale, int32 offset, uint64& deltaSum);
+
+namespace DecodeKernels {
+
+FORCE_INLINE __m128i LoadUint32(const uint8* data)
+{
+    int32 value;
+    memcpy(&value, data, sizeof(value));
+    return _mm_cvtsi32_si128(value);
+}
+
+FORCE_INLINE void StoreUint32(uint8* data, __m128i value)
+{
+    const int32 lowValue = _mm_cvtsi128_si32(value);
+    memcpy(data, &lowValue, sizeof(lowValue));
+}
+
+// Downsample domain block rows and apply color transform.
+// Writes 'Size' x 'Size' tile (in domain block coordinates).
+template<uint32 Size>
+FORCE_INLINE void SampleDomainTile(const uint8* src, uint32 imageSize, uint32 domainX, uint32 domainY,
+                                   int32 scale, int32 offset, uint8* tile)
+{
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i rounding = _mm_set1_epi16(1);
+    const __m128i scaleVec = _mm_set1_epi16((short)scale);
+    const __m128i offsetVec = _mm_set1_epi16((short)offset);
+
+    for (uint32 y = 0; y < Size; ++y)
+    {
+        const uint8* rowA = src + (domainY + 2 * y) * imageSize + domainX;
+        const uint8* rowB = rowA + imageSize;
+        uint8* tileRow = tile + y * Size;
+
+        // each iteration produces (up to) 8 pixels from 16 bytes of two rows
+        for (uint32 x = 0; x < Size; x += 8)
+        {
+            __m128i a, b;
+            if (Size >= 8)
+            {
+                a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowA + 2 * x));
+                b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowB + 2 * x));
+            }
+            else
+            {
+                a = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rowA));
+                b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rowB));
+            }
+
+            // (a0 + a1 + b0 + b1 + 1) / 4
+            __m128i sum = _mm_add_epi16(_mm_maddubs_epi16(a, ones), _mm_maddubs_epi16(b, ones));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+
+            // ((scale * value) >> shift) + offset, clamped to 0...255
+            __m128i value = _mm_srai_epi16(_mm_mullo_epi16(sum, scaleVec), DOMAIN_SCALE_BITS - DOMAIN_SCALE_RANGE_BITS);
+            value = _mm_add_epi16(value, offsetVec);
+            value = _mm_packus_epi16(value, value);
+
+            if (Size >= 8)
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(tileRow + x), value);
+            else
+                StoreUint32(tileRow, value);
+        }
+    }
+}
+
+// Transpose 8x8 block of bytes
+FORCE_INLINE void Transpose8x8(const uint8* src, uint32 srcStride, uint8* dest, uint32 destStride)
+{
+    const __m128i r0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 0 * srcStride));
+    const __m128i r1 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 1 * srcStride));
+    const __m128i r2 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 2 * srcStride));
+    const __m128i r3 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 3 * srcStride));
+    const __m128i r4 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 4 * srcStride));
+    const __m128i r5 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 5 * srcStride));
+    const __m128i r6 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 6 * srcStride));
+    const __m128i r7 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 7 * srcStride));
+
+    const __m128i a0 = _mm_unpacklo_epi8(r0, r1);
+    const __m128i a1 = _mm_unpacklo_epi8(r2, r3);
+    const __m128i a2 = _mm_unpacklo_epi8(r4, r5);
+    const __m128i a3 = _mm_unpacklo_epi8(r6, r7);
+
+    const __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    const __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    const __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    const __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+    // each register holds two columns
+    const __m128i c0 = _mm_unpacklo_epi32(b0, b2);
+    const __m128i c1 = _mm_unpackhi_epi32(b0, b2);
+    const __m128i c2 = _mm_unpacklo_epi32(b1, b3);
+    const __m128i c3 = _mm_unpackhi_epi32(b1, b3);
+
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 0 * destStride), c0);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 1 * destStride), _mm_unpackhi_epi64(c0, c0));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 2 * destStride), c1);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 3 * destStride), _mm_unpackhi_epi64(c1, c1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 4 * destStride), c2);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 5 * destStride), _mm_unpackhi_epi64(c2, c2));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 6 * destStride), c3);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 7 * destStride), _mm_unpackhi_epi64(c3, c3));
+}
+
+template<uint32 Size>
+FORCE_INLINE void TransposeTile(const uint8* tile, uint8* outTile)
+{
+    if (Size >= 8)
+    {
+        for (uint32 y = 0; y < Size; y += 8)
+        {
+            for (uint32 x = 0; x < Size; x += 8)
+            {
+                Transpose8x8(tile + y * Size + x, Size, outTile + x * Size + y, Size);
+            }
+        }
+    }
+    else
+    {
+        for (uint32 y = 0; y < Size; ++y)
+        {
+            for (uint32 x = 0; x < Size; ++x)
+            {
+                outTile[x * Size + y] = tile[y * Size + x];
+            }
+        }
+    }
+}
+
+// Load (up to) 16 pixels of a tile row, optionally in reversed order
+template<uint32 Size, bool Reverse>
+FORCE_INLINE __m128i LoadTileRow(const uint8* tileRow, uint32 x)
+{
+    if (Size >= 16)
+    {
+        if (Reverse)
+        {
+            const __m128i reverseMask = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tileRow + Size - 16 - x));
+            return _mm_shuffle_epi8(v, reverseMask);
+        }
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(tileRow + x));
+    }
+    else if (Size == 8)
+    {
+        const __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(tileRow));
+        if (Reverse)
+        {
+            // upper lanes are zeroed
+            const __m128i reverseMask = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, -1, -1, -1, -1, -1, -1, -1, -1);
+            return _mm_shuffle_epi8(v, reverseMask);
+        }
+        return v;
+    }
+    else
+    {
+        const __m128i v = LoadUint32(tileRow);
+        if (Reverse)
+        {
+            const __m128i reverseMask = _mm_setr_epi8(3, 2, 1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+            return _mm_shuffle_epi8(v, reverseMask);
+        }
+        return v;
+    }
+}
+
+template<uint32 Size>
+FORCE_INLINE __m128i LoadImageRow(const uint8* row)
+{
+    if (Size >= 16)
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+    else if (Size == 8)
+        return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row));
+    else
+        return LoadUint32(row);
+}
+
+template<uint32 Size>
+FORCE_INLINE void StoreImageRow(uint8* row, __m128i value)
+{
+    if (Size >= 16)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row), value);
+    else if (Size == 8)
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(row), value);
+    else
+        StoreUint32(row, value);
+}
+
+template<uint32 Size, uint32 Transform>
+uint32 DecodeRange(const uint8* src, uint8* dest, uint32 imageSize,
+                   uint32 rx0, uint32 ry0, uint32 domainX, uint32 domainY,
+                   int32 scale, int32 offset, uint64& deltaSum)
+{
+    // Output row 'y' of each transform is a (possibly reversed) row of the domain tile
+    // or of the transposed domain tile (see TransformLocation):
+    //   0: row y                   1: reversed row y
+    //   2: transposed row S-1-y    3: reversed transposed row S-1-y
+    //   4: reversed row S-1-y      5: row S-1-y
+    //   6: reversed transposed y   7: transposed row y
+    const bool transpose = Transform == 2 || Transform == 3 || Transform == 6 || Transform == 7;
+    const bool reverse = Transform == 1 || Transform == 3 || Transform == 4 || Transform == 6;
+    const bool flipRows = Transform == 2 || Transform == 3 || Transform == 4 || Transform == 5;
+
+    alignas(16) uint8 tile[Size * Size];
+    alignas(16) uint8 transposedTile[transpose ? Size * Size : 1];
+
+    // the whole domain is sampled first, so in-place decoding of overlapping domain and range is well defined
+    SampleDomainTile<Size>(src, imageSize, domainX, domainY, scale, offset, tile);
+
+    const uint8* sourceTile = tile;
+    if (transpose)
+    {
+        TransposeTile<Size>(tile, transposedTile);
+        sourceTile = transposedTile;
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    __m128i maxDelta = zero;
+    __m128i sumDelta = zero;
+
+    for (uint32 y = 0; y < Size; ++y)
+    {
+        const uint8* tileRow = sourceTile + (flipRows ? (Size - 1 - y) : y) * Size;
+        const uint8* prevRow = src + (ry0 + y) * imageSize + rx0;
+        uint8* destRow = dest + (ry0 + y) * imageSize + rx0;
+
+        for (uint32 x = 0; x < Size; x += 16)
+        {
+            const __m128i value = LoadTileRow<Size, reverse>(tileRow, x);
+            const __m128i prevValue = LoadImageRow<Size>(prevRow + x);
+
+            // absolute difference (unused lanes are zero)
+            const __m128i delta = _mm_or_si128(_mm_subs_epu8(value, prevValue), _mm_subs_epu8(prevValue, value));
+            maxDelta = _mm_max_epu8(maxDelta, delta);
+            sumDelta = _mm_add_epi64(sumDelta, _mm_sad_epu8(delta, zero));
+
+            StoreImageRow<Size>(destRow + x, value);
+        }
+    }
+
+    sumDelta = _mm_add_epi64(sumDelta, _mm_unpackhi_epi64(sumDelta, sumDelta));
+    deltaSum += (uint64)(uint32)_mm_cvtsi128_si32(sumDelta);
+
+    maxDelta = _mm_max_epu8(maxDelta, _mm_srli_si128(maxDelta, 8));
+    maxDelta = _mm_max_epu8(maxDelta, _mm_srli_si128(maxDelta, 4));
+    maxDelta = _mm_max_epu8(maxDelta, _mm_srli_si128(maxDelta, 2));
+    maxDelta = _mm_max_epu8(maxDelta, _mm_srli_si128(maxDelta, 1));
+    return (uint32)_mm_cvtsi128_si32(maxDelta) & 0xFF;
+}
+
+} // namespace DecodeKernels
+
+// Returns kernel for given range block size and domain transform (or null if the size is not supported)
+inline DecodeKernel GetDecodeKernel(uint32 rangeSize, uint32 transform)
+{
+#define DECODE_KERNELS_FOR_SIZE(Size) \
+    { &DecodeKernels::DecodeRange<Size, 0>, &DecodeKernels::DecodeRange<Size, 1>, \
+      &DecodeKernels::DecodeRange<Size, 2>, &DecodeKernels::DecodeRange<Size, 3>, \
+      &DecodeKernels::DecodeRange<Size, 4>, &DecodeKernels::DecodeRange<Size, 5>, \
+      &DecodeKernels::DecodeRange<Size, 6>, &DecodeKernels::DecodeRange<Size, 7> }
+
+    // sizes above the encoder's maximum range size are used by upscaled decoding
+    static const DecodeKernel kernels[6][8] =
+    {
+        DECODE_KERNELS_FOR_SIZE(4),
+        DECODE_KERNELS_FOR_SIZE(8),
+        DECODE_KERNELS_FOR_SIZE(16),
+        DECODE_KERNELS_FOR_SIZE(32),
+        DECODE_KERNELS_FOR_SIZE(64),
+        DECODE_KERNELS_FOR_SIZE(128),
+    };
+
+#undef DECODE_KERNELS_FOR_SIZE
+
+    uint32 sizeIndex = 0;
+    while (sizeIndex < 6 && ((uint32)DECODE_KERNEL_MIN_RANGE_SIZE << sizeIndex) != rangeSize)
+        sizeIndex++;
+
+    if (sizeIndex >= 6 || transform >= 8)
+    {
+        return nullptr;
+    }
+
+    return kernels[sizeIndex][transform];
+}
@@ -0,0 +1,451 @@
+#include "decode_plan.h"
+#include "quadtree_index.h"
+#include "thread_pool.h"
+
+#include <iostream>
+#include <assert.h>
+#include <algorithm>
+#include <functional>
+#include <string.h>
+#include <cmath>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+DecodePlan::DecodePlan()
+    : mImageSize(0)
+    , mMinRangeSize(0)
+    , mMaxIntScale(0)
+{ }
+
+bool DecodePlan::Build(const QuadtreeCodeView& quadtreeCode, const DomainArrayView& domains,
+                       uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize, bool useKernels,
+                       int32 resolutionShift, const QuadtreeIndexView& index, ThreadPool* threadPool)
+{
+    assert(resolutionShift >= DECODE_MIN_RESOLUTION_SHIFT && resolutionShift <= DECODE_MAX_RESOLUTION_SHIFT);
+
+    // geometry is scaled up by 'upShift' bits and down by 'downShift' bits
+    const uint32 upShift = resolutionShift > 0 ? (uint32)resolutionShift : 0;
+    const uint32 downShift = resolutionShift < 0 ? (uint32)(-resolutionShift) : 0;
+    const uint32 downMask = (1 << downShift) - 1;
+
+    mLeaves.clear();
+    mCellLeaves.clear();
+    mImageSize = (imageSize << upShift) >> downShift;
+    mMinRangeSize = std::max<uint32>(1, (minRangeSize << upShift) >> downShift);
+
+    if (mImageSize == 0)
+    {
+        std::cout << "Decoding resolution is too low" << std::endl;
+        return false;
+    }
+
+    uint32 imageSizeBits = 0;
+    {
+        uint32 i = imageSize;
+        while (i >>= 1) ++imageSizeBits;
+    }
+    const uint32 domainScaling = imageSizeBits > DOMAIN_LOCATION_BITS ? imageSizeBits - DOMAIN_LOCATION_BITS : 0;
+
+    mLeaves.reserve(domains.GetSize());
+
+    // merged range blocks are skipped, but they still matter for the iteration bound
+    mMaxIntScale = 0;
+    for (uint32 i = 0; i < domains.GetSize(); ++i)
+    {
+        mMaxIntScale = std::max<int32>(mMaxIntScale, std::abs((int32)domains[i].scale - (1 << (DOMAIN_SCALE_BITS - 1))));
+    }
+
+    // build leaves of a single row of root ranges, starting at given split flag and domain
+    // returns false if the quadtree code and domains don't match
+    const auto buildRow = [&](uint32 rowY0, uint32& flagIndex, uint32& domainIndex, std::vector<DecodeLeaf>& outLeaves) -> bool
+    {
+        bool corrupted = false;
+
+        std::function<void(uint32, uint32, uint32)> buildRange;
+        buildRange = [&](uint32 rx0, uint32 ry0, uint32 rangeSize)
+        {
+            // check if this range should be subdivided
+            bool subdivide = false;
+            if (rangeSize > minRangeSize)
+            {
+                if (flagIndex >= quadtreeCode.GetSize())
+                {
+                    corrupted = true;
+                    return;
+                }
+                subdivide = quadtreeCode.GetBit(flagIndex++);
+            }
+
+            if (subdivide)
+            {
+                const uint32 subRangeSize = rangeSize / 2;
+                for (uint32 i = 0; i < 2 && !corrupted; ++i)
+                {
+                    for (uint32 j = 0; j < 2 && !corrupted; ++j)
+                    {
+                        buildRange(rx0 + j * subRangeSize, ry0 + i * subRangeSize, subRangeSize);
+                    }
+                }
+            }
+            else // !subdivide
+            {
+                if (domainIndex >= domains.GetSize())
+                {
+                    corrupted = true;
+                    return;
+                }
+
+                const Domain domain = domains[domainIndex++];
+
+                // range blocks smaller than a pixel - decode only the one at the pixel's corner
+                if (((rx0 | ry0) & downMask) != 0)
+                {
+                    return;
+                }
+
+                // range and domain geometry at the decoding resolution
+                const uint32 decodedRangeSize = std::max<uint32>(1, (rangeSize << upShift) >> downShift);
+                const uint32 domainX = ((domain.x << domainScaling) << upShift) >> downShift;
+                const uint32 domainY = ((domain.y << domainScaling) << upShift) >> downShift;
+
+                // domain transform is an affine mapping, so it's enough to transform three points
+                uint32 tx00, ty00, tx10, ty10, tx01, ty01;
+                TransformLocation(decodedRangeSize, 0, 0, domain.transform, tx00, ty00);
+                TransformLocation(decodedRangeSize, 1, 0, domain.transform, tx10, ty10);
+                TransformLocation(decodedRangeSize, 0, 1, domain.transform, tx01, ty01);
+
+                DecodeLeaf leaf;
+                leaf.rx0 = (rx0 << upShift) >> downShift;
+                leaf.ry0 = (ry0 << upShift) >> downShift;
+                leaf.rangeSize = decodedRangeSize;
+                leaf.dx0 = domainX + 2 * tx00;
+                leaf.dy0 = domainY + 2 * ty00;
+                leaf.dxStepX = 2 * ((int32)tx10 - (int32)tx00);
+                leaf.dyStepX = 2 * ((int32)ty10 - (int32)ty00);
+                leaf.dxStepY = 2 * ((int32)tx01 - (int32)tx00);
+                leaf.dyStepY = 2 * ((int32)ty01 - (int32)ty00);
+                leaf.scale = domain.GetIntScale();
+                leaf.offset = domain.GetIntOffset();
+                leaf.domainX = domainX;
+                leaf.domainY = domainY;
+                leaf.transform = (uint8)domain.transform;
+
+                // kernels don't handle wrapping around the image edges
+                leaf.kernel = nullptr;
+                if (useKernels && domainX + 2 * decodedRangeSize <= mImageSize && domainY + 2 * decodedRangeSize <= mImageSize)
+                {
+                    leaf.kernel = GetDecodeKernel(decodedRangeSize, leaf.transform);
+                }
+
+                outLeaves.push_back(leaf);
+            }
+        };
+
+        for (uint32 rx0 = 0; rx0 < imageSize && !corrupted; rx0 += maxRangeSize)
+        {
+            buildRange(rx0, rowY0, maxRangeSize);
+        }
+
+        return !corrupted;
+    };
+
+    const uint32 numRows = imageSize / maxRangeSize;
+    uint32 numDomains = 0;
+    bool corrupted = false;
+
+    if (!index.IsEmpty())
+    {
+        // the index tells where every row starts, so the rows are built independently
+        // (every row must end exactly where the next one starts)
+        if (index.GetNumRows() != numRows || !index.IsConsistent(quadtreeCode.GetSize(), domains.GetSize()))
+        {
+            std::cout << "Quadtree index does not match the quadtree code" << std::endl;
+            mLeaves.clear();
+            return false;
+        }
+
+        std::vector<std::vector<DecodeLeaf>> rowLeaves(numRows);
+        std::vector<uint8> rowValid(numRows, 0);
+
+        const auto buildIndexedRow = [&](uint32 row, uint32)
+        {
+            uint32 flagIndex = index[row].flagOffset;
+            uint32 domainIndex = index[row].domainIndex;
+            rowValid[row] = buildRow(row * maxRangeSize, flagIndex, domainIndex, rowLeaves[row]) &&
+                            flagIndex == index[row + 1].flagOffset && domainIndex == index[row + 1].domainIndex;
+        };
+
+        if (threadPool && threadPool->GetNumThreads() > 1)
+        {
+            threadPool->ParallelFor(numRows, buildIndexedRow);
+        }
+        else
+        {
+            for (uint32 row = 0; row < numRows; ++row)
+            {
+                buildIndexedRow(row, 0);
+            }
+        }
+
+        for (uint32 row = 0; row < numRows; ++row)
+        {
+            corrupted |= !rowValid[row];
+            mLeaves.insert(mLeaves.end(), rowLeaves[row].begin(), rowLeaves[row].end());
+        }
+        numDomains = index[numRows].domainIndex;
+    }
+    else
+    {
+        uint32 flagIndex = 0;
+        for (uint32 row = 0; row < numRows && !corrupted; ++row)
+        {
+            corrupted = !buildRow(row * maxRangeSize, flagIndex, numDomains, mLeaves);
+        }
+    }
+
+    if (corrupted || numDomains != domains.GetSize())
+    {
+        std::cout << "Quadtree code does not match domains data" << std::endl;
+        mLeaves.clear();
+        return false;
+    }
+
+    // map cells to leaves
+    const uint32 numCellsInRow = mImageSize / mMinRangeSize;
+    mCellLeaves.resize(numCellsInRow * numCellsInRow);
+    for (uint32 i = 0; i < (uint32)mLeaves.size(); ++i)
+    {
+        const DecodeLeaf& leaf = mLeaves[i];
+        for (uint32 y = leaf.ry0 / mMinRangeSize; y < (leaf.ry0 + leaf.rangeSize) / mMinRangeSize; ++y)
+        {
+            for (uint32 x = leaf.rx0 / mMinRangeSize; x < (leaf.rx0 + leaf.rangeSize) / mMinRangeSize; ++x)
+            {
+                mCellLeaves[y * numCellsInRow + x] = i;
+            }
+        }
+    }
+
+    return true;
+}
+
+void DecodePlan::Initialize(Image& dest) const
+{
+    assert(dest.GetSize() == mImageSize);
+
+    for (const DecodeLeaf& leaf : mLeaves)
+    {
+        // v = (scale * v >> shift) + offset  =>  v = offset / (1 - scale / 2^shift)
+        // not contractive transforms have no (stable) fixed point, so mid-gray is used
+        const int32 denominator = (1 << DOMAIN_INT_SCALE_SHIFT) - leaf.scale;
+        int32 value = 128;
+        if (denominator > 0)
+        {
+            value = leaf.offset * (1 << DOMAIN_INT_SCALE_SHIFT) / denominator;
+        }
+        const uint8 color = (uint8)std::max<int32>(0, std::min<int32>(255, value));
+
+        for (uint32 y = 0; y < leaf.rangeSize; ++y)
+        {
+            memset(dest.GetData() + (leaf.ry0 + y) * mImageSize + leaf.rx0, color, leaf.rangeSize);
+        }
+    }
+}
+
+void DecodePlan::Execute(const Image& src, Image& dest, DecompressionDelta& outDelta) const
+{
+    Execute(src, dest, 0, (uint32)mLeaves.size(), outDelta);
+}
+
+void DecodePlan::Execute(const Image& src, Image& dest, uint32 firstLeaf, uint32 lastLeaf, DecompressionDelta& outDelta) const
+{
+    assert(src.GetSize() == mImageSize);
+    assert(dest.GetSize() == mImageSize);
+    assert(firstLeaf <= lastLeaf && lastLeaf <= (uint32)mLeaves.size());
+
+    for (uint32 i = firstLeaf; i < lastLeaf; ++i)
+    {
+        ExecuteLeaf(mLeaves[i], src, dest, outDelta);
+    }
+}
+
+void DecodePlan::ExecuteLeaves(const Image& src, Image& dest, const uint32* leafIndices, uint32 numLeaves, DecompressionDelta& outDelta) const
+{
+    assert(src.GetSize() == mImageSize);
+    assert(dest.GetSize() == mImageSize);
+
+    for (uint32 i = 0; i < numLeaves; ++i)
+    {
+        ExecuteLeaf(mLeaves[leafIndices[i]], src, dest, outDelta);
+    }
+}
+
+void DecodePlan::FindDependencies(uint32 x, uint32 y, uint32 width, uint32 height, uint32 maxDepth,
+                                  std::vector<uint32>& outLeaves, std::vector<uint32>& outDepthEnd) const
+{
+    assert(x + width <= mImageSize && y + height <= mImageSize);
+
+    outLeaves.clear();
+    outDepthEnd.clear();
+
+    if (width == 0 || height == 0)
+    {
+        return;
+    }
+
+    const uint32 numCellsInRow = mImageSize / mMinRangeSize;
+    const uint32 cellMask = numCellsInRow - 1;
+
+    std::vector<bool> visited(mLeaves.size(), false);
+    const auto visitCell = [&](uint32 cellX, uint32 cellY)
+    {
+        const uint32 leafIndex = mCellLeaves[(cellY & cellMask) * numCellsInRow + (cellX & cellMask)];
+        if (!visited[leafIndex])
+        {
+            visited[leafIndex] = true;
+            outLeaves.push_back(leafIndex);
+        }
+    };
+
+    // depth 0 - leaves intersecting the region
+    for (uint32 cellY = y / mMinRangeSize; cellY <= (y + height - 1) / mMinRangeSize; ++cellY)
+    {
+        for (uint32 cellX = x / mMinRangeSize; cellX <= (x + width - 1) / mMinRangeSize; ++cellX)
+        {
+            visitCell(cellX, cellY);
+        }
+    }
+    outDepthEnd.push_back((uint32)outLeaves.size());
+
+    // breadth-first search, domains can wrap around the image edges
+    uint32 depthBegin = 0;
+    for (uint32 depth = 1; depth <= maxDepth; ++depth)
+    {
+        const uint32 depthEnd = outDepthEnd.back();
+        for (uint32 i = depthBegin; i < depthEnd; ++i)
+        {
+            const DecodeLeaf& leaf = mLeaves[outLeaves[i]];
+
+            // domain block covers 2x range size pixels
+            const uint32 firstCellX = leaf.domainX / mMinRangeSize;
+            const uint32 firstCellY = leaf.domainY / mMinRangeSize;
+            const uint32 lastCellX = (leaf.domainX + 2 * leaf.rangeSize - 1) / mMinRangeSize;
+            const uint32 lastCellY = (leaf.domainY + 2 * leaf.rangeSize - 1) / mMinRangeSize;
+
+            for (uint32 cellY = firstCellY; cellY <= lastCellY; ++cellY)
+            {
+                for (uint32 cellX = firstCellX; cellX <= lastCellX; ++cellX)
+                {
+                    visitCell(cellX, cellY);
+                }
+            }
+        }
+
+        if (outLeaves.size() == depthEnd)
+        {
+            break; // closure is complete
+        }
+
+        depthBegin = depthEnd;
+        outDepthEnd.push_back((uint32)outLeaves.size());
+    }
+}
+
+void DecodePlan::Partition(uint32 numParts, std::vector<uint32>& boundaries) const
+{
+    assert(numParts > 0);
+
+    const uint64 totalPixels = (uint64)mImageSize * (uint64)mImageSize;
+
+    boundaries.clear();
+    boundaries.reserve(numParts + 1);
+    boundaries.push_back(0);
+
+    uint64 pixels = 0;
+    for (uint32 i = 0; i < (uint32)mLeaves.size(); ++i)
+    {
+        pixels += mLeaves[i].rangeSize * mLeaves[i].rangeSize;
+
+        // close the part when it reaches its share of the pixels
+        const uint32 part = (uint32)boundaries.size();
+        if (part < numParts && pixels * numParts >= totalPixels * part)
+        {
+            boundaries.push_back(i + 1);
+        }
+    }
+
+    while (boundaries.size() < numParts + 1)
+    {
+        boundaries.push_back((uint32)mLeaves.size());
+    }
+}
+
+uint32 DecodePlan::CalculateIterationBound(float tolerance) const
+{
+    const float maxScale = (float)mMaxIntScale / (float)(1 << (DOMAIN_SCALE_BITS - DOMAIN_SCALE_RANGE_BITS));
+    if (maxScale >= 1.0f || tolerance <= 0.0f)
+    {
+        return 0;
+    }
+
+    // constant image is decoded after a single iteration
+    if (maxScale == 0.0f)
+    {
+        return 1;
+    }
+
+    // initial error is at most 255 and it shrinks at least maxScale times with every iteration
+    const float bound = std::ceil(std::log(tolerance / 255.0f) / std::log(maxScale));
+    return bound < 1.0f ? 1 : (uint32)bound;
+}
+
+void DecodePlan::ExecuteLeaf(const DecodeLeaf& leaf, const Image& src, Image& dest, DecompressionDelta& outDelta) const
+{
+    if (leaf.kernel)
+    {
+        const uint32 maxDelta = leaf.kernel(src.GetData(), dest.GetData(), mImageSize, leaf.rx0, leaf.ry0,
+                                            leaf.domainX, leaf.domainY, leaf.scale, leaf.offset, outDelta.sum);
+        outDelta.max = std::max<uint32>(outDelta.max, maxDelta);
+        return;
+    }
+
+    uint32 maxDelta = 0;
+    uint32 deltaSum = 0;
+
+    uint32 rowDx = leaf.dx0;
+    uint32 rowDy = leaf.dy0;
+
+    for (uint32 y = 0; y < leaf.rangeSize; y++)
+    {
+        const uint32 ry = leaf.ry0 + y;
+
+        uint32 dx = rowDx;
+        uint32 dy = rowDy;
+
+        for (uint32 x = 0; x < leaf.rangeSize; x++)
+        {
+            // sample domain (with downsampling)
+            const int32 domainPixelColor = (int32)src.SampleDomain(dx, dy);
+
+            // transform color
+            const int32 value = ((leaf.scale * domainPixelColor) >> DOMAIN_INT_SCALE_SHIFT) + leaf.offset;
+            const uint8 color = (uint8)std::max<int32>(0, std::min<int32>(255, value));
+
+            // measure change since the previous iteration
+            const uint32 delta = (uint32)std::abs((int32)color - (int32)src.Sample(leaf.rx0 + x, ry));
+            maxDelta = std::max<uint32>(maxDelta, delta);
+            deltaSum += delta;
+
+            dest.WritePixel(leaf.rx0 + x, ry, color);
+
+            dx += leaf.dxStepX;
+            dy += leaf.dyStepX;
+        }
+
+        rowDx += leaf.dxStepY;
+        rowDy += leaf.dyStepY;
+    }
+
+    outDelta.max = std::max<uint32>(outDelta.max, maxDelta);
+    outDelta.sum += deltaSum;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "common.h"
+#include "domain.h"
+#include "image.h"
+#include "quadtree.h"
+#include "quadtree_index.h"
+#include "decode_kernels.h"
+
+#include <vector>
+
+class ThreadPool;
+
+// supported decoding resolutions: encoded image size * 2^shift
+#define DECODE_MIN_RESOLUTION_SHIFT (-3)
+#define DECODE_MAX_RESOLUTION_SHIFT 2
+#define DECODE_NUM_RESOLUTIONS (DECODE_MAX_RESOLUTION_SHIFT - DECODE_MIN_RESOLUTION_SHIFT + 1)
+
+//////////////////////////////////////////////////////////////////////////
+
+// pixel changes accumulated during single decompression iteration
+struct DecompressionDelta
+{
+    uint32 max;
+    uint64 sum;
+
+    DecompressionDelta()
+        : max(0), sum(0)
+    { }
+};
+
+// Single range block of the decode plan (quadtree leaf)
+struct DecodeLeaf
+{
+    // destination range block
+    uint32 rx0, ry0;
+    uint32 rangeSize;
+
+    // domain pixel (top-left corner of the 2x2 block) sampled for range pixel (0, 0)
+    uint32 dx0, dy0;
+
+    // domain pixel step per range pixel step in X and Y (encodes the transform)
+    int32 dxStepX, dyStepX;
+    int32 dxStepY, dyStepY;
+
+    // fixed point color transform (see Domain::TransformColor)
+    int32 scale;
+    int32 offset;
+
+    // domain block location (top-left corner, before the transform)
+    uint32 domainX, domainY;
+
+    // specialized decoding kernel (null if not available - e.g. domain wraps around the image)
+    DecodeKernel kernel;
+
+    uint8 transform;
+};
+
+/**
+* Quadtree and domains compiled into a flat array of range blocks.
+* Built once per compressed image, so decoder iterations don't have to parse the quadtree code
+* nor decode domain bitfields.
+*/
+class DecodePlan
+{
+public:
+    DecodePlan();
+
+    // compile quadtree code and domains (owned by a Compressor, or referenced in place - see CompressedImageView)
+    // fails if the quadtree code and domains don't match
+    // 'useKernels' enables specialized SIMD decoding kernels (see decode_kernels.h)
+    // 'resolutionShift' scales range and domain geometry, so the image is decoded at (imageSize * 2^resolutionShift)
+    // 'index' (optional) - rows of root ranges are built independently, in parallel if 'threadPool' is given
+    // NOTE: when downscaling, range blocks smaller than a pixel are merged - only the first one is decoded
+    bool Build(const QuadtreeCodeView& quadtreeCode, const DomainArrayView& domains,
+               uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize, bool useKernels = true,
+               int32 resolutionShift = 0, const QuadtreeIndexView& index = QuadtreeIndexView(), ThreadPool* threadPool = nullptr);
+
+    // fill every range block with the fixed point of its color transform (value v for which v = scale * v + offset),
+    // so the iterations start close to the final image
+    void Initialize(Image& dest) const;
+
+    // run single IFS iteration: map 'src' image to 'dest' image (may be the same image)
+    void Execute(const Image& src, Image& dest, DecompressionDelta& outDelta) const;
+
+    // run single IFS iteration for a subset of leaves [firstLeaf, lastLeaf)
+    void Execute(const Image& src, Image& dest, uint32 firstLeaf, uint32 lastLeaf, DecompressionDelta& outDelta) const;
+
+    // run single IFS iteration for given leaves only
+    void ExecuteLeaves(const Image& src, Image& dest, const uint32* leafIndices, uint32 numLeaves, DecompressionDelta& outDelta) const;
+
+    // split leaves into (up to) 'numParts' consecutive parts with similar number of pixels
+    // outputs part boundaries (leaf indices, numParts + 1 elements)
+    void Partition(uint32 numParts, std::vector<uint32>& outBoundaries) const;
+
+    // Find leaves influencing given region of the image within 'maxDepth' iterations (dependency closure).
+    // 'outLeaves' are sorted by depth: 0 - leaves intersecting the region, 1 - leaves sampled by domains
+    // of depth 0 leaves, etc. 'outDepthEnd[d]' is number of leaves with depth <= d.
+    void FindDependencies(uint32 x, uint32 y, uint32 width, uint32 height, uint32 maxDepth,
+                          std::vector<uint32>& outLeaves, std::vector<uint32>& outDepthEnd) const;
+
+    // Calculate number of iterations after which error of the decoded image
+    // is guaranteed to be below given tolerance (0 if the domains are not contractive)
+    uint32 CalculateIterationBound(float tolerance) const;
+
+    const std::vector<DecodeLeaf>& GetLeaves() const
+    {
+        return mLeaves;
+    }
+
+    // decoded image size (after resolution shift)
+    uint32 GetImageSize() const
+    {
+        return mImageSize;
+    }
+
+private:
+    void ExecuteLeaf(const DecodeLeaf& leaf, const Image& src, Image& dest, DecompressionDelta& outDelta) const;
+
+    std::vector<DecodeLeaf> mLeaves;
+    uint32 mImageSize;
+    uint32 mMinRangeSize;
+
+    // largest color scaling of the domains (as used by Domain::TransformColor)
+    int32 mMaxIntScale;
+
+    // leaf index for every cell of minimum (decoded) range size
+    std::vector<uint32> mCellLeaves;
+};
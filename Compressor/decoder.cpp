@@ -0,0 +1,679 @@
+#include "decoder.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <iostream>
+#include <assert.h>
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <string.h>
+#include <emmintrin.h>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+// number of decoder tasks per thread (for load balancing)
+#define DECOMPRESSION_PARTS_PER_THREAD 4
+
+// region decompression falls back to full decompression if it would decode more of the image
+#define DECOMPRESSION_REGION_MAX_FRACTION 0.9f
+
+// Tikhonov regularization of the Anderson least squares problem (relative to the largest residual norm)
+#define DECOMPRESSION_ANDERSON_REGULARIZATION 1.0e-6
+
+namespace {
+
+// sum of products of two residual images
+int64 DotProduct(const int16* a, const int16* b, uint32 count)
+{
+    int64 sum = 0;
+    uint32 i = 0;
+
+    // 32-bit lanes can accumulate up to 8192 products of two 9-bit values
+    const uint32 blockSize = 8192;
+    while (i + 8 <= count)
+    {
+        const uint32 blockEnd = std::min<uint32>(count & ~7u, i + blockSize);
+        __m128i blockSum = _mm_setzero_si128();
+        for (; i < blockEnd; i += 8)
+        {
+            const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            blockSum = _mm_add_epi32(blockSum, _mm_madd_epi16(va, vb));
+        }
+
+        int32 lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), blockSum);
+        sum += (int64)lanes[0] + (int64)lanes[1] + (int64)lanes[2] + (int64)lanes[3];
+    }
+
+    for (; i < count; ++i)
+    {
+        sum += (int32)a[i] * (int32)b[i];
+    }
+
+    return sum;
+}
+
+// residual of the mapped image: mapped - current
+void CalculateResidual(const uint8* mapped, const uint8* current, int16* outResidual, uint32 count)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    uint32 i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mapped + i));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + i));
+        const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(m, zero), _mm_unpacklo_epi8(c, zero));
+        const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(m, zero), _mm_unpackhi_epi8(c, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(outResidual + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(outResidual + i + 8), hi);
+    }
+
+    for (; i < count; ++i)
+    {
+        outResidual[i] = (int16)((int32)mapped[i] - (int32)current[i]);
+    }
+}
+
+// weighted sum of images (rounded and clamped)
+void MixImages(const uint8* const* images, const float* weights, uint32 numImages, uint8* dest, uint32 count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    uint32 i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128 sums[4] = { half, half, half, half };
+        for (uint32 k = 0; k < numImages; ++k)
+        {
+            const __m128 weight = _mm_set1_ps(weights[k]);
+            const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(images[k] + i));
+            const __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+            const __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+            sums[0] = _mm_add_ps(sums[0], _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero))));
+            sums[1] = _mm_add_ps(sums[1], _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero))));
+            sums[2] = _mm_add_ps(sums[2], _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero))));
+            sums[3] = _mm_add_ps(sums[3], _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero))));
+        }
+
+        // saturating packs clamp the values to [0, 255]
+        const __m128i lo = _mm_packs_epi32(_mm_cvttps_epi32(sums[0]), _mm_cvttps_epi32(sums[1]));
+        const __m128i hi = _mm_packs_epi32(_mm_cvttps_epi32(sums[2]), _mm_cvttps_epi32(sums[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packus_epi16(lo, hi));
+    }
+
+    for (; i < count; ++i)
+    {
+        float value = 0.5f;
+        for (uint32 k = 0; k < numImages; ++k)
+        {
+            value += weights[k] * (float)images[k][i];
+        }
+        dest[i] = (uint8)std::max(0.0f, std::min(255.0f, value));
+    }
+}
+
+// Find coefficients (summing to one) of the residuals combination with the smallest norm.
+// 'products' are residual inner products (n x n), returns false if the system is singular.
+bool SolveMixingCoefficients(const double* products, uint32 n, double* outCoefficients)
+{
+    double matrix[DECOMPRESSION_ANDERSON_DEPTH + 1][DECOMPRESSION_ANDERSON_DEPTH + 1];
+    double maxDiagonal = 0.0;
+    for (uint32 i = 0; i < n; ++i)
+    {
+        maxDiagonal = std::max(maxDiagonal, products[i * n + i]);
+    }
+
+    if (maxDiagonal <= 0.0)
+    {
+        return false;
+    }
+
+    // solve (products + regularization) * y = 1, then normalize y
+    for (uint32 i = 0; i < n; ++i)
+    {
+        for (uint32 j = 0; j < n; ++j)
+        {
+            matrix[i][j] = products[i * n + j];
+        }
+        matrix[i][i] += DECOMPRESSION_ANDERSON_REGULARIZATION * maxDiagonal;
+        outCoefficients[i] = 1.0;
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (uint32 k = 0; k < n; ++k)
+    {
+        uint32 pivot = k;
+        for (uint32 i = k + 1; i < n; ++i)
+        {
+            if (std::abs(matrix[i][k]) > std::abs(matrix[pivot][k]))
+                pivot = i;
+        }
+
+        if (std::abs(matrix[pivot][k]) < 1.0e-12 * maxDiagonal)
+        {
+            return false;
+        }
+
+        if (pivot != k)
+        {
+            for (uint32 j = 0; j < n; ++j)
+                std::swap(matrix[k][j], matrix[pivot][j]);
+            std::swap(outCoefficients[k], outCoefficients[pivot]);
+        }
+
+        for (uint32 i = k + 1; i < n; ++i)
+        {
+            const double factor = matrix[i][k] / matrix[k][k];
+            for (uint32 j = k; j < n; ++j)
+                matrix[i][j] -= factor * matrix[k][j];
+            outCoefficients[i] -= factor * outCoefficients[k];
+        }
+    }
+
+    double sum = 0.0;
+    for (int32 i = (int32)n - 1; i >= 0; --i)
+    {
+        double value = outCoefficients[i];
+        for (uint32 j = i + 1; j < n; ++j)
+            value -= matrix[i][j] * outCoefficients[j];
+        outCoefficients[i] = value / matrix[i][i];
+        sum += outCoefficients[i];
+    }
+
+    if (std::abs(sum) < 1.0e-12)
+    {
+        return false;
+    }
+
+    for (uint32 i = 0; i < n; ++i)
+    {
+        outCoefficients[i] /= sum;
+    }
+    return true;
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+Decoder::Decoder()
+    : mCurrentImage(0)
+    , mParallelPlan(nullptr)
+    , mParallelSrc(nullptr)
+    , mParallelDest(nullptr)
+{ }
+
+Decoder::~Decoder()
+{ }
+
+Image Decoder::TakeImage()
+{
+    return std::move(mImages[mCurrentImage]);
+}
+
+bool Decoder::PrepareImages(const DecodePlan& plan, const DecompressionSettings& settings, bool inPlace)
+{
+    const uint32 size = plan.GetImageSize();
+
+    // buffers are reused if the size matches (decoding overwrites all the pixels anyway)
+    for (uint32 i = 0; i < (inPlace ? 1u : 2u); ++i)
+    {
+        Image& image = mImages[i];
+        if (image.GetSize() != size || image.GetChannelsNum() != 1)
+        {
+            if (!image.Resize(size, 1))
+            {
+                return false;
+            }
+        }
+    }
+
+    // the first iteration reads mImages[0] in both modes
+    if (settings.init == DecompressionInit::FixedPoint)
+    {
+        plan.Initialize(mImages[0]);
+    }
+    else
+    {
+        memset(mImages[0].GetData(), 0, (size_t)size * (size_t)size);
+    }
+
+    mCurrentImage = 0;
+    return true;
+}
+
+ThreadPool* Decoder::GetThreadPool(uint32 numThreads)
+{
+    if (numThreads == 1 || (numThreads == 0 && std::thread::hardware_concurrency() <= 1))
+    {
+        return nullptr;
+    }
+
+    const uint32 requestedThreads = numThreads > 0 ? numThreads : std::thread::hardware_concurrency();
+    if (!mThreadPool || mThreadPool->GetNumThreads() != requestedThreads)
+    {
+        mThreadPool.reset(new ThreadPool(requestedThreads));
+    }
+
+    return mThreadPool.get();
+}
+
+void Decoder::ExecuteParallel(const DecodePlan& plan, const Image& src, Image& dest, DecompressionDelta& outDelta)
+{
+    mParallelPlan = &plan;
+    mParallelSrc = &src;
+    mParallelDest = &dest;
+
+    // this is a barrier - all the parts are decoded when it returns
+    // NOTE: the task captures only 'this', so no memory is allocated for it
+    mThreadPool->ParallelFor((uint32)mPartDeltas.size(), [this](uint32 part, uint32)
+    {
+        mPartDeltas[part] = DecompressionDelta();
+        mParallelPlan->Execute(*mParallelSrc, *mParallelDest, mPartBoundaries[part], mPartBoundaries[part + 1],
+                               mPartDeltas[part]);
+    });
+
+    // reduce
+    for (const DecompressionDelta& partDelta : mPartDeltas)
+    {
+        outDelta.max = std::max<uint32>(outDelta.max, partDelta.max);
+        outDelta.sum += partDelta.sum;
+    }
+}
+
+bool Decoder::Decode(const DecodePlan& plan, const DecompressionSettings& settings, DecompressionStats* outStats)
+{
+    const uint32 size = plan.GetImageSize();
+    if (size == 0)
+    {
+        std::cout << "Decode plan is empty" << std::endl;
+        return false;
+    }
+
+    uint32 iterationBound = 0;
+    const uint32 maxIterations = GetMaxIterations(plan, settings, iterationBound);
+
+    ThreadPool* threadPool = GetThreadPool(settings.numThreads);
+    if (threadPool)
+    {
+        plan.Partition(DECOMPRESSION_PARTS_PER_THREAD * threadPool->GetNumThreads(), mPartBoundaries);
+        mPartDeltas.resize(mPartBoundaries.size() - 1);
+    }
+
+    // ranges decoded in parallel would read pixels written by other threads,
+    // the Anderson solver mixes whole images
+    const bool anderson = settings.solver == DecompressionSolver::Anderson;
+    const bool inPlace = settings.inPlace && !threadPool && !anderson;
+
+    if (!PrepareImages(plan, settings, inPlace))
+    {
+        return false;
+    }
+
+    uint32 iteration = 0;
+    float delta = 0.0f;
+    float meanDeltas[2] = { 0.0f, 0.0f }; // first two iterations
+    if (anderson)
+    {
+        if (!SolveAnderson(plan, settings, maxIterations, threadPool, iteration, delta, meanDeltas))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        SolvePicard(plan, settings, maxIterations, threadPool, inPlace, iteration, delta, meanDeltas);
+    }
+
+    if (outStats)
+    {
+        outStats->iterations = iteration;
+        outStats->finalDelta = delta;
+        outStats->iterationBound = iterationBound;
+        outStats->decodedFraction = 1.0f;
+        outStats->iterationsSaved = iteration >= 2 ? EstimateIterationsSaved(plan, settings, meanDeltas[0], meanDeltas[1]) : 0.0f;
+    }
+
+    return true;
+}
+
+bool Decoder::DecodeRegion(const DecodePlan& plan, uint32 x, uint32 y, uint32 width, uint32 height,
+                           const DecompressionSettings& settings, DecompressionStats* outStats)
+{
+    const uint32 size = plan.GetImageSize();
+    if (width == 0 || height == 0 || x >= size || y >= size || width > size - x || height > size - y)
+    {
+        std::cout << "Invalid decompression region" << std::endl;
+        return false;
+    }
+
+    uint32 iterationBound = 0;
+    const uint32 maxIterations = GetMaxIterations(plan, settings, iterationBound);
+    if (maxIterations == 0)
+    {
+        return Decode(plan, settings, outStats);
+    }
+
+    // Iteration i (counting from 0) must update leaves of depth up to (maxIterations - 1 - i).
+    // Leaves of depth d read only leaves of depth d + 1, which were updated in the previous iteration,
+    // so the region is decoded exactly as in the full decompression.
+    {
+        TRACE_SCOPE("FindDependencies");
+        plan.FindDependencies(x, y, width, height, maxIterations - 1, mRegionLeaves, mRegionDepthEnd);
+    }
+
+    uint64 closurePixels = 0;
+    for (const uint32 leafIndex : mRegionLeaves)
+    {
+        const uint32 rangeSize = plan.GetLeaves()[leafIndex].rangeSize;
+        closurePixels += rangeSize * rangeSize;
+    }
+
+    const float decodedFraction = (float)closurePixels / ((float)size * (float)size);
+    if (decodedFraction > DECOMPRESSION_REGION_MAX_FRACTION)
+    {
+        return Decode(plan, settings, outStats);
+    }
+
+    // the metric is normalized to the region's dependencies
+    const float invNumPixels = 1.0f / (float)closurePixels;
+
+    // NOTE: multithreading is not used here - there is not enough work to split
+    // NOTE: in-place decoding updates leaves in a different order than the full decompression,
+    // so the region is not bit-exact with it (it converges to the same image, though)
+    const bool inPlace = settings.inPlace;
+
+    if (!PrepareImages(plan, settings, inPlace))
+    {
+        return false;
+    }
+
+    uint32 iteration = 0;
+    float delta = 0.0f;
+    while (iteration < maxIterations)
+    {
+        TRACE_SCOPE("DecompressRegionIteration", "iteration", iteration);
+
+        if (!inPlace)
+        {
+            mCurrentImage ^= 1;
+        }
+        const Image& src = mImages[inPlace ? mCurrentImage : mCurrentImage ^ 1];
+        Image& dest = mImages[mCurrentImage];
+
+        const uint32 depth = std::min<uint32>(maxIterations - 1 - iteration, (uint32)mRegionDepthEnd.size() - 1);
+
+        DecompressionDelta iterationDelta;
+        plan.ExecuteLeaves(src, dest, mRegionLeaves.data(), mRegionDepthEnd[depth], iterationDelta);
+
+        iteration++;
+
+        if (settings.metric == ConvergenceMetric::MaxDelta)
+            delta = (float)iterationDelta.max;
+        else
+            delta = (float)iterationDelta.sum * invNumPixels;
+
+        if (delta < settings.tolerance)
+            break;
+    }
+
+    if (outStats)
+    {
+        outStats->iterations = iteration;
+        outStats->finalDelta = delta;
+        outStats->iterationBound = iterationBound;
+        outStats->decodedFraction = decodedFraction;
+    }
+
+    return true;
+}
+
+void Decoder::SolvePicard(const DecodePlan& plan, const DecompressionSettings& settings, uint32 maxIterations,
+                          ThreadPool* threadPool, bool inPlace, uint32& outIterations, float& outDelta, float* outMeanDeltas)
+{
+    const uint32 size = plan.GetImageSize();
+    const float invNumPixels = 1.0f / ((float)size * (float)size);
+
+    uint32 iteration = 0;
+    float delta = 0.0f;
+    while (iteration < maxIterations)
+    {
+        TRACE_SCOPE("DecompressIteration", "iteration", iteration);
+
+        // swap images (in-place decoding reads and writes the same image)
+        if (!inPlace)
+        {
+            mCurrentImage ^= 1;
+        }
+        const Image& src = mImages[inPlace ? mCurrentImage : mCurrentImage ^ 1];
+        Image& dest = mImages[mCurrentImage];
+
+        DecompressionDelta iterationDelta;
+        if (threadPool)
+        {
+            ExecuteParallel(plan, src, dest, iterationDelta);
+        }
+        else
+        {
+            plan.Execute(src, dest, iterationDelta);
+        }
+
+        iteration++;
+
+        // check convergence
+        if (settings.metric == ConvergenceMetric::MaxDelta)
+            delta = (float)iterationDelta.max;
+        else
+            delta = (float)iterationDelta.sum * invNumPixels;
+
+        if (iteration <= 2)
+            outMeanDeltas[iteration - 1] = (float)iterationDelta.sum * invNumPixels;
+
+        if (delta < settings.tolerance)
+            break;
+    }
+
+    outIterations = iteration;
+    outDelta = delta;
+}
+
+bool Decoder::SolveAnderson(const DecodePlan& plan, const DecompressionSettings& settings, uint32 maxIterations,
+                            ThreadPool* threadPool, uint32& outIterations, float& outDelta, float* outMeanDeltas)
+{
+    const uint32 historySize = DECOMPRESSION_ANDERSON_DEPTH + 1;
+    const uint32 size = plan.GetImageSize();
+    const uint32 numPixels = size * size;
+    const float invNumPixels = 1.0f / (float)numPixels;
+
+    for (uint32 i = 0; i < historySize; ++i)
+    {
+        if (mMappedImages[i].GetSize() != size || mMappedImages[i].GetChannelsNum() != 1)
+        {
+            if (!mMappedImages[i].Resize(size, 1))
+            {
+                return false;
+            }
+        }
+        mResiduals[i].resize(numPixels);
+    }
+
+    // x(k + 1) = sum(a_i * T(x_i)) over the last few iterates, where coefficients a_i (summing to one)
+    // minimize norm of sum(a_i * (T(x_i) - x_i)) - for affine T it's the best T(x) estimate in their span
+    Image& current = mImages[0];
+    double residualProducts[historySize][historySize];
+    uint32 numEntries = 0;                  // valid history entries
+    bool mixing = true;
+    uint32 newest = historySize - 1;        // newest history entry
+    uint32 iteration = 0;
+    float delta = 0.0f;
+    while (iteration < maxIterations)
+    {
+        TRACE_SCOPE("DecompressIteration", "iteration", iteration);
+
+        newest = (newest + 1) % historySize;
+        Image& mapped = mMappedImages[newest];
+
+        DecompressionDelta iterationDelta;
+        if (threadPool)
+        {
+            ExecuteParallel(plan, current, mapped, iterationDelta);
+        }
+        else
+        {
+            plan.Execute(current, mapped, iterationDelta);
+        }
+
+        iteration++;
+
+        // pixel change of T(x) is the residual, so the convergence check is the same as for Picard iteration
+        if (settings.metric == ConvergenceMetric::MaxDelta)
+            delta = (float)iterationDelta.max;
+        else
+            delta = (float)iterationDelta.sum * invNumPixels;
+
+        if (iteration <= 2)
+            outMeanDeltas[iteration - 1] = (float)iterationDelta.sum * invNumPixels;
+
+        if (delta < settings.tolerance || iteration == maxIterations)
+            break;
+
+        // plain Picard step (swaps contents of the buffers, the history is not needed anymore)
+        if (!mixing)
+        {
+            std::swap(current, mapped);
+            continue;
+        }
+
+        TRACE_SCOPE("AndersonMixing");
+
+        const uint8* mappedData = mapped.GetData();
+        int16* residual = mResiduals[newest].data();
+        CalculateResidual(mappedData, current.GetData(), residual, numPixels);
+
+        // history entries, from the newest one
+        uint32 entries[historySize];
+        numEntries = std::min<uint32>(numEntries + 1, historySize);
+        for (uint32 k = 0; k < numEntries; ++k)
+        {
+            entries[k] = (newest + historySize - k) % historySize;
+            const double product = (double)DotProduct(residual, mResiduals[entries[k]].data(), numPixels);
+            residualProducts[newest][entries[k]] = product;
+            residualProducts[entries[k]][newest] = product;
+        }
+
+        // restart if the residual does not decrease (the mixing does not help, e.g. because of the rounding)
+        if (numEntries > 1 && residualProducts[newest][newest] >= residualProducts[entries[1]][entries[1]])
+        {
+            numEntries = 1;
+        }
+
+        // Below one level per pixel the residual is dominated by the rounding - rounded combinations of
+        // almost identical images give back the same image and the iteration stalls, so the solver
+        // falls back to Picard iteration for the rest of the decoding.
+        if (residualProducts[newest][newest] < (double)numPixels)
+        {
+            mixing = false;
+            numEntries = 1;
+        }
+
+        double coefficients[historySize] = { 1.0 };
+        if (numEntries > 1)
+        {
+            double products[historySize * historySize];
+            for (uint32 i = 0; i < numEntries; ++i)
+            {
+                for (uint32 j = 0; j < numEntries; ++j)
+                {
+                    products[i * numEntries + j] = residualProducts[entries[i]][entries[j]];
+                }
+            }
+
+            if (!SolveMixingCoefficients(products, numEntries, coefficients))
+            {
+                numEntries = 1;
+                coefficients[0] = 1.0;
+            }
+        }
+
+        uint8* currentPixels = current.GetData();
+        if (numEntries == 1)
+        {
+            // plain Picard step (the history is kept)
+            memcpy(currentPixels, mappedData, numPixels);
+            continue;
+        }
+
+        const uint8* mappedImages[historySize];
+        float weights[historySize];
+        for (uint32 k = 0; k < numEntries; ++k)
+        {
+            mappedImages[k] = mMappedImages[entries[k]].GetData();
+            weights[k] = (float)coefficients[k];
+        }
+
+        MixImages(mappedImages, weights, numEntries, currentPixels, numPixels);
+    }
+
+    // the result is the last T(x), as in Picard iteration
+    if (iteration > 0)
+    {
+        std::swap(mImages[0], mMappedImages[newest]);
+    }
+
+    mCurrentImage = 0;
+    outIterations = iteration;
+    outDelta = delta;
+    return true;
+}
+
+float Decoder::EstimateIterationsSaved(const DecodePlan& plan, const DecompressionSettings& settings,
+                                       float firstMeanDelta, float secondMeanDelta)
+{
+    if (settings.init == DecompressionInit::Black || firstMeanDelta <= 0.0f || secondMeanDelta <= 0.0f)
+    {
+        return 0.0f;
+    }
+
+    // starting from a black image, the first iteration writes the (clamped) offsets
+    uint64 blackSumDelta = 0;
+    for (const DecodeLeaf& leaf : plan.GetLeaves())
+    {
+        const uint32 color = (uint32)std::max<int32>(0, std::min<int32>(255, leaf.offset));
+        blackSumDelta += (uint64)color * leaf.rangeSize * leaf.rangeSize;
+    }
+
+    const float size = (float)plan.GetImageSize();
+    const float blackMeanDelta = (float)blackSumDelta / (size * size);
+
+    // The pixel change shrinks (roughly) geometrically, so the initial image saved as many iterations
+    // as it takes to shrink the change from 'blackMeanDelta' to 'firstMeanDelta'.
+    // Mean change is used regardless of the convergence metric - maximum is dominated by few pixels.
+    const float rate = secondMeanDelta / firstMeanDelta;
+    if (rate >= 1.0f || blackMeanDelta <= firstMeanDelta)
+    {
+        return 0.0f;
+    }
+
+    return std::log(blackMeanDelta / firstMeanDelta) / std::log(1.0f / rate);
+}
+
+uint32 Decoder::GetMaxIterations(const DecodePlan& plan, const DecompressionSettings& settings,
+                                 uint32& outIterationBound)
+{
+    uint32 maxIterations = settings.maxIterations;
+    outIterationBound = 0;
+    if (settings.useContractivityBound)
+    {
+        outIterationBound = plan.CalculateIterationBound(settings.tolerance);
+        if (outIterationBound > 0)
+        {
+            maxIterations = std::min<uint32>(maxIterations, outIterationBound);
+        }
+    }
+    return maxIterations;
+}
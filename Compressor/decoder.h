@@ -0,0 +1,187 @@
+#pragma once
+
+#include "common.h"
+#include "image.h"
+#include "decode_plan.h"
+
+#include <vector>
+#include <memory>
+
+class ThreadPool;
+
+// number of previous iterates mixed by the Anderson solver
+#define DECOMPRESSION_ANDERSON_DEPTH 3
+
+//////////////////////////////////////////////////////////////////////////
+
+enum class ConvergenceMetric
+{
+    MaxDelta,       // maximum absolute pixel change
+    MeanDelta,      // mean absolute pixel change
+};
+
+enum class DecompressionSolver
+{
+    Picard,         // plain fixed-point iteration: x = T(x)
+    Anderson,       // next iterate is the combination of the last few T(x) with the smallest residual
+};
+
+enum class DecompressionInit
+{
+    Black,          // all-zero image
+    FixedPoint,     // every range block filled with the fixed point of its color transform
+};
+
+struct DecompressionSettings
+{
+    // hard limit of IFS iterations
+    uint32 maxIterations;
+
+    // decompression stops when per-iteration pixel change falls below this value
+    // (by default, it stops when no pixel changes by more than one level - rounding
+    // in the integer decoder makes some pixels oscillate forever)
+    float tolerance;
+    ConvergenceMetric metric;
+
+    // limit number of iterations using contractivity of the decoded domains (maximum |scale|)
+    bool useContractivityBound;
+
+    // decode in a single buffer (Gauss-Seidel iteration), so ranges see pixels already updated
+    // in the current iteration - converges faster and needs half of the memory
+    // NOTE: ignored by the multithreaded decoder and the Anderson solver
+    bool inPlace;
+
+    // fixed-point solver
+    // Anderson mixing needs fewer iterations when the scales are close to DOMAIN_SCALE_RANGE (slow contraction),
+    // but every iteration is more expensive and it needs 3 * (DECOMPRESSION_ANDERSON_DEPTH + 1) more bytes per pixel
+    // NOTE: region decompression always uses Picard iteration
+    DecompressionSolver solver;
+
+    // number of decoding threads (0 - all the hardware threads)
+    uint32 numThreads;
+
+    // decoding resolution: decoded image size is (encoded image size * 2^resolutionShift)
+    // e.g. -2 decodes a quarter-size thumbnail directly, without decoding the full image,
+    // and 1 decodes the image at twice the encoded resolution
+    int32 resolutionShift;
+
+    // initial image the iterations start from
+    DecompressionInit init;
+
+    DecompressionSettings()
+        : maxIterations(100)
+        , tolerance(2.0f)
+        , metric(ConvergenceMetric::MaxDelta)
+        , useContractivityBound(false)
+        , inPlace(false)
+        , solver(DecompressionSolver::Picard)
+        , numThreads(1)
+        , resolutionShift(0)
+        , init(DecompressionInit::FixedPoint)
+    { }
+};
+
+struct DecompressionStats
+{
+    uint32 iterations;      // number of iterations actually performed
+    float finalDelta;       // pixel change in the last iteration (according to the selected metric)
+    uint32 iterationBound;  // a-priori iteration bound (0 if not used or domains are not contractive)
+    float decodedFraction;  // fraction of the image pixels decoded in the first iteration (1.0 for full decode)
+
+    // iterations saved by the initial image (compared to starting from a black image), estimated from
+    // the pixel change in the first iterations (full decompression only)
+    float iterationsSaved;
+
+    DecompressionStats()
+        : iterations(0), finalDelta(0.0f), iterationBound(0), decodedFraction(0.0f), iterationsSaved(0.0f)
+    { }
+};
+
+/**
+* Reusable decoding context.
+* Decode plans are immutable, so one plan can be shared by any number of decoders running concurrently
+* (see Compressor::GetDecodePlan). A decoder keeps its image buffers, worker threads and scratch memory
+* between the calls - decoding images of the same size again allocates nothing.
+* NOTE: a single decoder must not be used by multiple threads at once (use one decoder per thread).
+*/
+class Decoder
+{
+public:
+    Decoder();
+    ~Decoder();
+
+    Decoder(const Decoder&) = delete;
+    Decoder& operator = (const Decoder&) = delete;
+
+    // run IFS iterations of the plan
+    // the decoded image is available via GetImage() until the next call
+    // NOTE: settings.resolutionShift is ignored - it's already applied to the plan
+    bool Decode(const DecodePlan& plan, const DecompressionSettings& settings = DecompressionSettings(),
+                DecompressionStats* outStats = nullptr);
+
+    // decode only a region of the image (see Compressor::DecompressRegion)
+    bool DecodeRegion(const DecodePlan& plan, uint32 x, uint32 y, uint32 width, uint32 height,
+                      const DecompressionSettings& settings = DecompressionSettings(),
+                      DecompressionStats* outStats = nullptr);
+
+    // the last decoded image
+    const Image& GetImage() const
+    {
+        return mImages[mCurrentImage];
+    }
+
+    // move the last decoded image out of the decoder (its buffer is allocated again by the next call)
+    Image TakeImage();
+
+private:
+    // resize decoding buffers (if needed) and fill the initial image
+    bool PrepareImages(const DecodePlan& plan, const DecompressionSettings& settings, bool inPlace);
+
+    // create (or reuse) worker threads, returns null if decoding is single-threaded
+    ThreadPool* GetThreadPool(uint32 numThreads);
+
+    // run plain fixed-point iterations, starting from mImages[0] (the result is in mImages[mCurrentImage])
+    // 'outMeanDeltas' receives mean pixel change of the first two iterations
+    void SolvePicard(const DecodePlan& plan, const DecompressionSettings& settings, uint32 maxIterations,
+                     ThreadPool* threadPool, bool inPlace, uint32& outIterations, float& outDelta, float* outMeanDeltas);
+
+    // run the iterations with Anderson mixing, starting from mImages[0] (the result is stored there as well)
+    // 'outMeanDeltas' receives mean pixel change of the first two iterations
+    bool SolveAnderson(const DecodePlan& plan, const DecompressionSettings& settings, uint32 maxIterations,
+                       ThreadPool* threadPool, uint32& outIterations, float& outDelta, float* outMeanDeltas);
+
+    // decode single iteration of the partitioned plan with the thread pool
+    void ExecuteParallel(const DecodePlan& plan, const Image& src, Image& dest, DecompressionDelta& outDelta);
+
+    // Estimate how many iterations a decoder starting from a black image would need more
+    // (from mean pixel change of the first two iterations)
+    static float EstimateIterationsSaved(const DecodePlan& plan, const DecompressionSettings& settings,
+                                         float firstMeanDelta, float secondMeanDelta);
+
+    // Get iteration limit for given settings (optionally, limited by contractivity bound)
+    static uint32 GetMaxIterations(const DecodePlan& plan, const DecompressionSettings& settings,
+                                   uint32& outIterationBound);
+
+    Image mImages[2];
+    uint32 mCurrentImage;
+
+    std::unique_ptr<ThreadPool> mThreadPool;
+
+    // plan partitioning for the thread pool (leaves are split into more parts than threads,
+    // so the load is balanced dynamically)
+    std::vector<uint32> mPartBoundaries;
+    std::vector<DecompressionDelta> mPartDeltas;
+
+    // current iteration executed by the thread pool
+    const DecodePlan* mParallelPlan;
+    const Image* mParallelSrc;
+    Image* mParallelDest;
+
+    // Anderson solver history (ring buffers): mapped iterates T(x) and residuals T(x) - x
+    Image mMappedImages[DECOMPRESSION_ANDERSON_DEPTH + 1];
+    std::vector<int16> mResiduals[DECOMPRESSION_ANDERSON_DEPTH + 1];
+
+    // region dependencies
+    std::vector<uint32> mRegionLeaves;
+    std::vector<uint32> mRegionDepthEnd;
+};
@@ -2,31 +2,32 @@
 
 #include "common.h"
 #include "settings.h"
+#include "domain_bits.h"
 
 #include <float.h>
 #include <algorithm>
+#include <vector>
 
 
 //////////////////////////////////////////////////////////////////////////
 
+// number of fractional bits of the fixed point color scale
+#define DOMAIN_INT_SCALE_SHIFT (DOMAIN_SCALE_BITS - DOMAIN_SCALE_RANGE_BITS)
+
+// bit positions of the fields in the packed domain (see Domain::Pack)
+// location and transform fill the low 16 bits, color mapping the high 16 bits
+#define DOMAIN_PACKED_X_SHIFT           0
+#define DOMAIN_PACKED_Y_SHIFT           (DOMAIN_PACKED_X_SHIFT + DOMAIN_LOCATION_BITS)
+#define DOMAIN_PACKED_TRANSFORM_SHIFT   (DOMAIN_PACKED_Y_SHIFT + DOMAIN_LOCATION_BITS)
+#define DOMAIN_PACKED_OFFSET_SHIFT      16
+#define DOMAIN_PACKED_SCALE_SHIFT       (DOMAIN_PACKED_OFFSET_SHIFT + DOMAIN_OFFSET_BITS)
+
 /**
 * Structure describing domain block to range block mapping.
 * This is the core of compressed image information - it drives the IFS during decompression.
 */
-struct Domain
+struct Domain : public DomainBits
 {
-    // domain location
-    uint16 x : DOMAIN_LOCATION_BITS;
-    uint16 y : DOMAIN_LOCATION_BITS;
-
-    // bit 0:       domain flip (in local X axis)
-    // bits 1-2:    domain rotation (0 - normal, 1 - 90 degree CCW, etc.)
-    uint16 transform : DOMAIN_TRANSFORM_BITS;
-
-    // color intensity mapping (scale and offset)
-    uint16 offset : DOMAIN_OFFSET_BITS;
-    uint16 scale : DOMAIN_SCALE_BITS;
-
     void SetOffset(float val)
     {
         const float maxValue = (float)((1 << DOMAIN_OFFSET_BITS) - 1);
@@ -61,23 +62,125 @@ struct Domain
         return ((float)scale / maxValue - 0.5f) * (float)(DOMAIN_SCALE_RANGE * 2);
     }
 
-    uint8 TransformColor(uint8 in) const
+    // fixed point color offset (used by the decoder)
+    int32 GetIntOffset() const
     {
         int32 intOffset = (int32)offset;
         intOffset <<= (DOMAIN_OFFSET_RANGE_BITS - DOMAIN_OFFSET_BITS);
         intOffset -= DOMAIN_OFFSET_RANGE;
+        return intOffset;
+    }
 
+    // fixed point color scale (DOMAIN_INT_SCALE_SHIFT fractional bits, used by the decoder)
+    int32 GetIntScale() const
+    {
         int32 intScale = (int32)scale;
         intScale -= (1 << (DOMAIN_SCALE_BITS - 1));
+        return intScale;
+    }
 
+    uint8 TransformColor(uint8 in) const
+    {
         int32 val = (int32)in;
-        val = ((intScale * val) >> (DOMAIN_SCALE_BITS - DOMAIN_SCALE_RANGE_BITS)) + intOffset; // TODO
+        val = ((GetIntScale() * val) >> DOMAIN_INT_SCALE_SHIFT) + GetIntOffset(); // TODO
         return static_cast<uint8>(std::max<int32>(0, std::min<int32>(255, val)));
     }
 
+    // Explicit 32-bit form of the domain (see DOMAIN_PACKED_*), used wherever domains are stored as raw words.
+    // Layout of the bitfields is up to the compiler, the packed form is not.
+    // NOTE: matches the bitfield layout of MSVC, GCC and Clang, so older raw files are read unchanged
+    uint32 Pack() const
+    {
+        return ((uint32)x << DOMAIN_PACKED_X_SHIFT) |
+               ((uint32)y << DOMAIN_PACKED_Y_SHIFT) |
+               ((uint32)transform << DOMAIN_PACKED_TRANSFORM_SHIFT) |
+               ((uint32)offset << DOMAIN_PACKED_OFFSET_SHIFT) |
+               ((uint32)scale << DOMAIN_PACKED_SCALE_SHIFT);
+    }
+
+    static Domain Unpack(uint32 packed)
+    {
+        Domain domain;
+        domain.x = (uint16)((packed >> DOMAIN_PACKED_X_SHIFT) & ((1 << DOMAIN_LOCATION_BITS) - 1));
+        domain.y = (uint16)((packed >> DOMAIN_PACKED_Y_SHIFT) & ((1 << DOMAIN_LOCATION_BITS) - 1));
+        domain.transform = (uint16)((packed >> DOMAIN_PACKED_TRANSFORM_SHIFT) & ((1 << DOMAIN_TRANSFORM_BITS) - 1));
+        domain.offset = (uint16)((packed >> DOMAIN_PACKED_OFFSET_SHIFT) & ((1 << DOMAIN_OFFSET_BITS) - 1));
+        domain.scale = (uint16)((packed >> DOMAIN_PACKED_SCALE_SHIFT) & ((1 << DOMAIN_SCALE_BITS) - 1));
+        return domain;
+    }
+};
+
+/**
+* Read-only access to domains stored either as Domain structures, or as packed words referenced
+* in place (e.g. a mapped file, see CompressedImageView).
+* NOTE: does not own the domains, they must outlive the view
+*/
+class DomainArrayView
+{
+public:
+    DomainArrayView()
+        : mDomains(nullptr)
+        , mPackedDomains(nullptr)
+        , mSize(0)
+    { }
+
+    DomainArrayView(const std::vector<Domain>& domains)
+        : mDomains(domains.data())
+        , mPackedDomains(nullptr)
+        , mSize((uint32)domains.size())
+    { }
+
+    // domains in the packed form (see Domain::Pack)
+    DomainArrayView(const uint32* packedDomains, uint32 size)
+        : mDomains(nullptr)
+        , mPackedDomains(packedDomains)
+        , mSize(size)
+    { }
+
+    uint32 GetSize() const
+    {
+        return mSize;
+    }
+
+    Domain operator [] (uint32 index) const
+    {
+        return mPackedDomains ? Domain::Unpack(mPackedDomains[index]) : mDomains[index];
+    }
+
+private:
+    const Domain* mDomains;
+    const uint32* mPackedDomains;
+    uint32 mSize;
 };
 
-//static_assert(sizeof(Domain) == 4, "Invalid domain size");
+// Transform range block location to domain block location (see Domain::transform)
+FORCE_INLINE void TransformLocation(uint32 rangeSize, uint32 x, uint32 y, uint8 transform, uint32& outX, uint32& outY)
+{
+    const uint32 offset = rangeSize - 1;
+
+    if (transform & 0x1)
+        x = offset - x;
+
+    switch (transform >> 1)
+    {
+    case 0:
+        outX = x;
+        outY = y;
+        break;
+    case 1:
+        outX = offset - y;
+        outY = x;
+        break;
+    case 2:
+        outX = offset - x;
+        outY = offset - y;
+        break;
+    case 3:
+        outX = y;
+        outY = offset - x;
+        break;
+    }
+}
 
 //////////////////////////////////////////////////////////////////////////
 
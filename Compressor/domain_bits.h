@@ -0,0 +1,31 @@
+#pragma once
+
+// Storage layout of a domain (see Domain).
+// NOTE: this header is shared with the demo, so it uses the types (uint16, etc.) defined by the includer.
+
+#include "settings.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+
+static_assert(DOMAIN_LOCATION_BITS * 2 + DOMAIN_TRANSFORM_BITS <= 16, "Domain location and transform must fit in 16 bits");
+static_assert(DOMAIN_OFFSET_BITS + DOMAIN_SCALE_BITS <= 16, "Domain color mapping must fit in 16 bits");
+
+/**
+* Fields of the domain block to range block mapping, in the order used by the generated source files
+* (see Compressor::SaveAsSourceFile).
+*/
+struct DomainBits
+{
+    // domain location
+    uint16 x : DOMAIN_LOCATION_BITS;
+    uint16 y : DOMAIN_LOCATION_BITS;
+
+    // bit 0:       domain flip (in local X axis)
+    // bits 1-2:    domain rotation (0 - normal, 1 - 90 degree CCW, etc.)
+    uint16 transform : DOMAIN_TRANSFORM_BITS;
+
+    // color intensity mapping (scale and offset)
+    uint16 offset : DOMAIN_OFFSET_BITS;
+    uint16 scale : DOMAIN_SCALE_BITS;
+};
@@ -0,0 +1,290 @@
+#include "domain_coder.h"
+#include "rans.h"
+
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+enum DomainField
+{
+    DomainFieldX,
+    DomainFieldY,
+    DomainFieldTransform,
+    DomainFieldOffset,
+    DomainFieldScale,
+
+    NumDomainFields
+};
+
+const uint32 gDomainFieldSymbols[NumDomainFields] =
+{
+    1 << DOMAIN_LOCATION_BITS,
+    1 << DOMAIN_LOCATION_BITS,
+    1 << DOMAIN_TRANSFORM_BITS,
+    1 << DOMAIN_OFFSET_BITS,
+    1 << DOMAIN_SCALE_BITS,
+};
+
+// each field is coded as a single symbol
+static_assert((1 << DOMAIN_LOCATION_BITS) <= RANS_MAX_SYMBOLS, "Domain location field too wide for the symbol models");
+static_assert((1 << DOMAIN_TRANSFORM_BITS) <= RANS_MAX_SYMBOLS, "Domain transform field too wide for the symbol models");
+static_assert((1 << DOMAIN_OFFSET_BITS) <= RANS_MAX_SYMBOLS, "Domain offset field too wide for the symbol models");
+static_assert((1 << DOMAIN_SCALE_BITS) <= RANS_MAX_SYMBOLS, "Domain scale field too wide for the symbol models");
+
+// model rebuild interval grows up to this number of symbols
+#define DOMAIN_MODEL_MAX_REBUILD_INTERVAL 1024
+
+#define DOMAIN_LOCATION_MASK ((1 << DOMAIN_LOCATION_BITS) - 1)
+
+// adaptive symbol model - rebuilt from symbol counts at growing intervals
+// (encoder and decoder rebuild at the same symbols, so no frequency tables are stored)
+class AdaptiveModel
+{
+public:
+    void Init(uint32 numSymbols)
+    {
+        // every symbol starts with count 1, so it keeps nonzero probability
+        mCounts.assign(numSymbols, 1);
+        mNumCoded = 0;
+        mRebuildInterval = 16;
+        mNextRebuild = mRebuildInterval;
+        mModel.Build(mCounts.data(), numSymbols);
+    }
+
+    const RansModel& GetModel() const
+    {
+        return mModel;
+    }
+
+    FORCE_INLINE void Update(uint32 symbol)
+    {
+        mCounts[symbol]++;
+        if (++mNumCoded == mNextRebuild)
+        {
+            mModel.Build(mCounts.data(), (uint32)mCounts.size());
+            mRebuildInterval = std::min<uint32>(2 * mRebuildInterval, DOMAIN_MODEL_MAX_REBUILD_INTERVAL);
+            mNextRebuild += mRebuildInterval;
+        }
+    }
+
+private:
+    RansModel mModel;
+    std::vector<uint32> mCounts;
+    uint32 mNumCoded;
+    uint32 mRebuildInterval;
+    uint32 mNextRebuild;
+};
+
+// coded value of a domain field
+FORCE_INLINE uint32 GetDomainSymbol(const Domain& domain, const DomainPrediction& prediction, uint32 field)
+{
+    switch (field)
+    {
+    case DomainFieldX:          return (domain.x - prediction.x) & DOMAIN_LOCATION_MASK;
+    case DomainFieldY:          return (domain.y - prediction.y) & DOMAIN_LOCATION_MASK;
+    case DomainFieldTransform:  return domain.transform;
+    case DomainFieldOffset:     return domain.offset;
+    case DomainFieldScale:      return domain.scale;
+    }
+    return 0;
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DomainCoder::PredictLocations(const QuadtreeCode& code, uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize,
+                                   std::vector<DomainPrediction>& outPredictions)
+{
+    if (minRangeSize == 0 || maxRangeSize < minRangeSize || imageSize < maxRangeSize)
+    {
+        return false;
+    }
+
+    uint32 imageSizeBits = 0;
+    {
+        uint32 i = imageSize;
+        while (i >>= 1) ++imageSizeBits;
+    }
+    const uint32 domainScaling = imageSizeBits > DOMAIN_LOCATION_BITS ? imageSizeBits - DOMAIN_LOCATION_BITS : 0;
+
+    QuadtreeCode sourceCode(code);
+    sourceCode.ResetCursor();
+    outPredictions.clear();
+
+    // the range block's corner in the domain lattice - domains tend to be found around their ranges
+    std::function<bool(uint32, uint32, uint32)> predictRange;
+    predictRange = [&](uint32 rx0, uint32 ry0, uint32 rangeSize) -> bool
+    {
+        bool subdivide = false;
+        if (rangeSize > minRangeSize)
+        {
+            if (sourceCode.GetCursor() >= sourceCode.GetSize())
+            {
+                return false;
+            }
+            subdivide = sourceCode.Get();
+        }
+
+        if (subdivide)
+        {
+            const uint32 subRangeSize = rangeSize / 2;
+            return predictRange(rx0,                    ry0,                    subRangeSize) &&
+                   predictRange(rx0 + subRangeSize,     ry0,                    subRangeSize) &&
+                   predictRange(rx0,                    ry0 + subRangeSize,     subRangeSize) &&
+                   predictRange(rx0 + subRangeSize,     ry0 + subRangeSize,     subRangeSize);
+        }
+
+        DomainPrediction prediction;
+        prediction.x = (uint8)((rx0 >> domainScaling) & DOMAIN_LOCATION_MASK);
+        prediction.y = (uint8)((ry0 >> domainScaling) & DOMAIN_LOCATION_MASK);
+        outPredictions.push_back(prediction);
+        return true;
+    };
+
+    for (uint32 ry0 = 0; ry0 + maxRangeSize <= imageSize; ry0 += maxRangeSize)
+    {
+        for (uint32 rx0 = 0; rx0 + maxRangeSize <= imageSize; rx0 += maxRangeSize)
+        {
+            if (!predictRange(rx0, ry0, maxRangeSize))
+            {
+                std::cout << "Quadtree does not match the image geometry" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool DomainCoder::Encode(const std::vector<Domain>& domains, const std::vector<DomainPrediction>& predictions,
+                         std::vector<uint8>& outData)
+{
+    if (!predictions.empty() && predictions.size() != domains.size())
+    {
+        std::cout << "Number of domain predictions does not match" << std::endl;
+        return false;
+    }
+
+    const DomainPrediction noPrediction = { 0, 0 };
+
+    AdaptiveModel models[NumDomainFields];
+    for (uint32 field = 0; field < NumDomainFields; ++field)
+    {
+        models[field].Init(gDomainFieldSymbols[field]);
+    }
+
+    // models adapt in the decoding order, but rANS works as a stack (symbols are encoded in reverse),
+    // so the symbol probabilities are recorded first
+    struct SymbolRange
+    {
+        uint16 start;
+        uint16 frequency;
+    };
+    std::vector<SymbolRange> ranges(domains.size() * NumDomainFields);
+
+    uint32 symbolIndex = 0;
+    for (size_t i = 0; i < domains.size(); ++i)
+    {
+        const DomainPrediction& prediction = predictions.empty() ? noPrediction : predictions[i];
+        for (uint32 field = 0; field < NumDomainFields; ++field)
+        {
+            const uint32 symbol = GetDomainSymbol(domains[i], prediction, field);
+            const RansModel& model = models[field].GetModel();
+            ranges[symbolIndex].start = (uint16)model.GetStart(symbol);
+            ranges[symbolIndex].frequency = (uint16)model.GetFrequency(symbol);
+            models[field].Update(symbol);
+            symbolIndex++;
+        }
+    }
+
+    // symbol k is coded with state (k % 2)
+    std::vector<uint8> reversedOutput;
+    reversedOutput.reserve(domains.size() * 4);
+
+    RansEncoder encoders[2];
+    while (symbolIndex-- > 0)
+    {
+        encoders[symbolIndex & 1].Put(ranges[symbolIndex].start, ranges[symbolIndex].frequency, reversedOutput);
+    }
+
+    // the first state is read first by the decoder
+    encoders[1].Flush(reversedOutput);
+    encoders[0].Flush(reversedOutput);
+
+    RansEncoder::Finish(reversedOutput, outData);
+    return true;
+}
+
+bool DomainCoder::Decode(const uint8* data, size_t dataSize, uint32 numDomains,
+                         const std::vector<DomainPrediction>& predictions, std::vector<Domain>& outDomains)
+{
+    const uint8* dataEnd = data + dataSize;
+
+    if (!predictions.empty() && predictions.size() != numDomains)
+    {
+        std::cout << "Number of domain predictions does not match" << std::endl;
+        return false;
+    }
+
+    const DomainPrediction noPrediction = { 0, 0 };
+
+    AdaptiveModel models[NumDomainFields];
+    for (uint32 field = 0; field < NumDomainFields; ++field)
+    {
+        models[field].Init(gDomainFieldSymbols[field]);
+    }
+
+    RansDecoder decoders[2];
+    if (!decoders[0].Init(data, dataEnd) || !decoders[1].Init(data, dataEnd))
+    {
+        std::cout << "Corrupted domains data" << std::endl;
+        return false;
+    }
+
+    outDomains.resize(numDomains);
+
+    // symbol parity alternates with every domain (odd number of fields)
+    static_assert(NumDomainFields == 5, "Decoding loop must match the domain fields");
+    uint32 first = 0;
+    for (uint32 i = 0; i < numDomains; ++i)
+    {
+        Domain& domain = outDomains[i];
+        const DomainPrediction& prediction = predictions.empty() ? noPrediction : predictions[i];
+
+        RansDecoder& d0 = decoders[first];
+        RansDecoder& d1 = decoders[first ^ 1];
+        const uint32 x = d0.Get(models[DomainFieldX].GetModel(), data, dataEnd);
+        const uint32 y = d1.Get(models[DomainFieldY].GetModel(), data, dataEnd);
+        const uint32 transform = d0.Get(models[DomainFieldTransform].GetModel(), data, dataEnd);
+        const uint32 offset = d1.Get(models[DomainFieldOffset].GetModel(), data, dataEnd);
+        const uint32 scale = d0.Get(models[DomainFieldScale].GetModel(), data, dataEnd);
+        first ^= 1;
+
+        models[DomainFieldX].Update(x);
+        models[DomainFieldY].Update(y);
+        models[DomainFieldTransform].Update(transform);
+        models[DomainFieldOffset].Update(offset);
+        models[DomainFieldScale].Update(scale);
+
+        domain.x = (uint16)((x + prediction.x) & DOMAIN_LOCATION_MASK);
+        domain.y = (uint16)((y + prediction.y) & DOMAIN_LOCATION_MASK);
+        domain.transform = (uint16)transform;
+        domain.offset = (uint16)offset;
+        domain.scale = (uint16)scale;
+    }
+
+    // all the data must be consumed and both states must end where the encoder started
+    if (!decoders[0].IsFinished() || !decoders[1].IsFinished() || data != dataEnd)
+    {
+        std::cout << "Corrupted domains data" << std::endl;
+        return false;
+    }
+
+    return true;
+}
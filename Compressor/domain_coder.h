@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+#include "domain.h"
+#include "quadtree.h"
+
+#include <vector>
+
+
+// predicted domain location (in the domain location lattice)
+struct DomainPrediction
+{
+    uint8 x;
+    uint8 y;
+};
+
+/**
+* Entropy coder of the domain parameters.
+* Every domain field (location, transform, color offset and scale) has its own adaptive rANS model,
+* rebuilt from the symbol counts by both the encoder and the decoder, so no tables are stored.
+* Consecutive symbols are coded with two interleaved rANS states, so the decoder can overlap their
+* dependency chains.
+* Domain locations are optionally coded as (wrapped) deltas from predicted locations, see PredictLocations.
+*/
+class DomainCoder
+{
+public:
+    // predict domain locations from the locations of their range blocks (in the quadtree order)
+    static bool PredictLocations(const QuadtreeCode& code, uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize,
+                                 std::vector<DomainPrediction>& outPredictions);
+
+    // number of lattice steps between domain location and its prediction (cheaper to code if lower)
+    static uint32 GetLocationDistance(uint32 location, uint32 predicted)
+    {
+        const uint32 delta = (location - predicted) & ((1 << DOMAIN_LOCATION_BITS) - 1);
+        return std::min<uint32>(delta, (1 << DOMAIN_LOCATION_BITS) - delta);
+    }
+
+    // append compressed domains to 'outData'
+    // locations are coded relative to 'predictions' (one per domain), or as absolute values if empty
+    static bool Encode(const std::vector<Domain>& domains, const std::vector<DomainPrediction>& predictions,
+                       std::vector<uint8>& outData);
+
+    // decompress 'numDomains' domains, fails if the data is corrupted
+    // 'predictions' must match the ones used for encoding
+    static bool Decode(const uint8* data, size_t dataSize, uint32 numDomains,
+                       const std::vector<DomainPrediction>& predictions, std::vector<Domain>& outDomains);
+};
@@ -1,19 +1,14 @@
 #include "image.h"
+#include "bitmap.h"
+#include "thread_pool.h"
 
-#include <Windows.h>
+#include <tmmintrin.h>
 #include <iostream>
 #include <string>
 #include <algorithm>
 #include <assert.h>
-
-
-#pragma pack(push, 2)
-struct BitmapFileHeader
-{
-    BITMAPFILEHEADER fileHeader;
-    BITMAPINFOHEADER infoHeader;
-};
-#pragma pack(pop)
+#include <string.h>
+#include <math.h>
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -29,6 +24,218 @@ struct BitmapFileHeader
 #define CONVERT_YCbCr2G(Y, Cb, Cr) CLIP(Y - ((1 * (Cr - 128) + (Cb - 128)) >> 1))
 #define CONVERT_YCbCr2B(Y, Cb, Cr) CLIP(Y + ((3 * (Cb - 128) - (Cr - 128)) >> 1))
 
+namespace {
+
+// decompose single row of 3- or 4-channel pixels into YCbCr components
+void ConvertRowToYCbCr(const uint8* src, uint32 bytesPerPixel, uint32 width, uint8* y, uint8* cb, uint8* cr)
+{
+    for (uint32 i = 0; i < width; i++)
+    {
+        const uint8 r = src[0];
+        const uint8 g = src[1];
+        const uint8 b = src[2];
+        src += bytesPerPixel;
+
+        y[i] = (uint8)CONVERT_RGB2Y(r, g, b);
+        cb[i] = (uint8)CONVERT_RGB2Cb(r, g, b);
+        cr[i] = (uint8)CONVERT_RGB2Cr(r, g, b);
+    }
+}
+
+// convert (and upsample chroma of) pixels [firstX, width) of single row from YCbCr into interleaved pixels
+void ConvertRowFromYCbCrScalar(const uint8* y, const uint8* cb, const uint8* cr, uint32 firstX, uint32 width,
+                               uint32 chromaShift, uint32 bytesPerPixel, uint8* dest)
+{
+    dest += firstX * bytesPerPixel;
+    for (uint32 i = firstX; i < width; i++)
+    {
+        const int32 yComp = y[i];
+        const int32 cbComp = cb[i >> chromaShift];
+        const int32 crComp = cr[i >> chromaShift];
+
+        dest[0] = (uint8)CONVERT_YCbCr2R(yComp, cbComp, crComp);
+        dest[1] = (uint8)CONVERT_YCbCr2G(yComp, cbComp, crComp);
+        dest[2] = (uint8)CONVERT_YCbCr2B(yComp, cbComp, crComp);
+        if (bytesPerPixel == 4)
+        {
+            dest[3] = 255;
+        }
+        dest += bytesPerPixel;
+    }
+}
+
+// load chroma values for 16 consecutive pixels (upsampled 2^ChromaShift times)
+template<uint32 ChromaShift>
+FORCE_INLINE __m128i LoadChroma16(const uint8* data)
+{
+    if (ChromaShift == 0)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    }
+    else if (ChromaShift == 1)
+    {
+        const __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data));
+        return _mm_unpacklo_epi8(v, v);
+    }
+    else if (ChromaShift == 2)
+    {
+        int32 value;
+        memcpy(&value, data, sizeof(value));
+        return _mm_shuffle_epi8(_mm_cvtsi32_si128(value), _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3));
+    }
+    else if (ChromaShift == 3)
+    {
+        uint16 value;
+        memcpy(&value, data, sizeof(value));
+        return _mm_shuffle_epi8(_mm_cvtsi32_si128(value), _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1));
+    }
+    else
+    {
+        return _mm_set1_epi8((char)data[0]);
+    }
+}
+
+// Y + (a >> 1) for 8 pixels (16-bit lanes)
+FORCE_INLINE __m128i AddHalf(__m128i y, __m128i a)
+{
+    return _mm_add_epi16(y, _mm_srai_epi16(a, 1));
+}
+
+// SIMD (SSSE3) version of ConvertRowFromYCbCrScalar, 16 pixels at a time
+template<uint32 ChromaShift>
+void ConvertRowFromYCbCr(const uint8* y, const uint8* cb, const uint8* cr, uint32 width, uint32 bytesPerPixel, uint8* dest)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_set1_epi8((char)255);
+
+    // 3 bytes per pixel interleaving: masks[channel][output vector] (see _mm_shuffle_epi8)
+    const __m128i masks[3][3] =
+    {
+        {
+            _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5),
+            _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1),
+            _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1),
+        },
+        {
+            _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1),
+            _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10),
+            _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1),
+        },
+        {
+            _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1),
+            _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1),
+            _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15),
+        },
+    };
+
+    uint32 x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i yVec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        const __m128i cbVec = LoadChroma16<ChromaShift>(cb + (x >> ChromaShift));
+        const __m128i crVec = LoadChroma16<ChromaShift>(cr + (x >> ChromaShift));
+
+        // 16-bit lanes: [0] - pixels 0..7, [1] - pixels 8..15
+        __m128i r[2], g[2], b[2];
+        for (uint32 half = 0; half < 2; ++half)
+        {
+            const __m128i yComp = half ? _mm_unpackhi_epi8(yVec, zero) : _mm_unpacklo_epi8(yVec, zero);
+            const __m128i cbComp = _mm_sub_epi16(half ? _mm_unpackhi_epi8(cbVec, zero) : _mm_unpacklo_epi8(cbVec, zero), bias);
+            const __m128i crComp = _mm_sub_epi16(half ? _mm_unpackhi_epi8(crVec, zero) : _mm_unpacklo_epi8(crVec, zero), bias);
+
+            // see CONVERT_YCbCr2R, CONVERT_YCbCr2G and CONVERT_YCbCr2B
+            r[half] = AddHalf(yComp, _mm_sub_epi16(_mm_add_epi16(crComp, _mm_add_epi16(crComp, crComp)), cbComp));
+            g[half] = _mm_sub_epi16(yComp, _mm_srai_epi16(_mm_add_epi16(crComp, cbComp), 1));
+            b[half] = AddHalf(yComp, _mm_sub_epi16(_mm_add_epi16(cbComp, _mm_add_epi16(cbComp, cbComp)), crComp));
+        }
+
+        // saturation does the clipping
+        const __m128i channels[3] =
+        {
+            _mm_packus_epi16(r[0], r[1]),
+            _mm_packus_epi16(g[0], g[1]),
+            _mm_packus_epi16(b[0], b[1]),
+        };
+
+        uint8* out = dest + x * bytesPerPixel;
+        if (bytesPerPixel == 3)
+        {
+            for (uint32 o = 0; o < 3; ++o)
+            {
+                const __m128i v = _mm_or_si128(_mm_or_si128(
+                    _mm_shuffle_epi8(channels[0], masks[0][o]),
+                    _mm_shuffle_epi8(channels[1], masks[1][o])),
+                    _mm_shuffle_epi8(channels[2], masks[2][o]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * o), v);
+            }
+        }
+        else
+        {
+            const __m128i rgLow = _mm_unpacklo_epi8(channels[0], channels[1]);
+            const __m128i rgHigh = _mm_unpackhi_epi8(channels[0], channels[1]);
+            const __m128i baLow = _mm_unpacklo_epi8(channels[2], alpha);
+            const __m128i baHigh = _mm_unpackhi_epi8(channels[2], alpha);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(rgLow, baLow));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi16(rgLow, baLow));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32), _mm_unpacklo_epi16(rgHigh, baHigh));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 48), _mm_unpackhi_epi16(rgHigh, baHigh));
+        }
+    }
+
+    ConvertRowFromYCbCrScalar(y, cb, cr, x, width, ChromaShift, bytesPerPixel, dest);
+}
+
+// select row conversion function for given chroma upsampling
+void ConvertRowFromYCbCr(const uint8* y, const uint8* cb, const uint8* cr, uint32 width,
+                         uint32 chromaShift, uint32 bytesPerPixel, uint8* dest)
+{
+    switch (chromaShift)
+    {
+    case 0: ConvertRowFromYCbCr<0>(y, cb, cr, width, bytesPerPixel, dest); break;
+    case 1: ConvertRowFromYCbCr<1>(y, cb, cr, width, bytesPerPixel, dest); break;
+    case 2: ConvertRowFromYCbCr<2>(y, cb, cr, width, bytesPerPixel, dest); break;
+    case 3: ConvertRowFromYCbCr<3>(y, cb, cr, width, bytesPerPixel, dest); break;
+    case 4: ConvertRowFromYCbCr<4>(y, cb, cr, width, bytesPerPixel, dest); break;
+    default: ConvertRowFromYCbCrScalar(y, cb, cr, 0, width, chromaShift, bytesPerPixel, dest); break;
+    }
+}
+
+// get chroma upsampling (as power of two)
+bool GetChromaShift(const Image& y, const Image& cb, const Image& cr, uint32& outChromaShift)
+{
+    if (y.GetChannelsNum() != 1 || cb.GetChannelsNum() != 1 || cr.GetChannelsNum() != 1 ||
+        cb.GetSize() != cr.GetSize() || cb.GetSize() == 0 || cb.GetSize() > y.GetSize())
+    {
+        std::cout << "Invalid YCbCr images" << std::endl;
+        return false;
+    }
+
+    // sizes are powers of two
+    outChromaShift = y.GetSizeBits() - cb.GetSizeBits();
+    return true;
+}
+
+// make sure the bitmap can be stored in an image
+bool ValidateBitmapSize(const BitmapReader& bitmap)
+{
+    if (bitmap.GetWidth() != bitmap.GetHeight())
+    {
+        std::cout << "Image width and height must be the same" << std::endl;
+        return false;
+    }
+
+    if ((bitmap.GetWidth() & (bitmap.GetWidth() - 1)) != 0)
+    {
+        std::cout << "Image dimensions must be power of two" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
 //////////////////////////////////////////////////////////////////////////
 
 bool Image::Resize(uint32 size, uint32 channels)
@@ -103,140 +310,96 @@ Image Image::Upsample() const
 
 bool Image::Load(const char* path)
 {
-    FILE* file = fopen(path, "rb");
-    if (!file)
+    BitmapReader bitmap;
+    if (!bitmap.Open(path))
     {
-        std::cout << "Failed to load source image: " << stderr << std::endl;
+        std::cout << "Failed to load source image" << std::endl;
         return false;
     }
 
-    BITMAPFILEHEADER fileHeader;
-    if (fread(&fileHeader, sizeof(BITMAPFILEHEADER), 1, file) != 1)
+    if (!ValidateBitmapSize(bitmap) || !Resize(bitmap.GetWidth(), 3))
     {
-        fclose(file);
-        std::cout << "Failed to read BMP file header: " << stderr << std::endl;
         return false;
     }
 
-    BITMAPINFOHEADER infoHeader;
-    if (fread(&infoHeader, sizeof(BITMAPINFOHEADER), 1, file) != 1)
+    // copy rows, skipping padding and unused alpha channel
+    for (uint32 y = 0; y < mSize; y++)
     {
-        fclose(file);
-        std::cout << "Failed to read BMP info header: " << stderr << std::endl;
-        return false;
+        const uint8* src = bitmap.GetRow(y);
+        uint8* dest = mData.data() + 3 * y * mSize;
+
+        if (bitmap.GetBytesPerPixel() == 3)
+        {
+            memcpy(dest, src, 3 * mSize);
+        }
+        else
+        {
+            for (uint32 x = 0; x < mSize; x++)
+            {
+                dest[3 * x] = src[4 * x];
+                dest[3 * x + 1] = src[4 * x + 1];
+                dest[3 * x + 2] = src[4 * x + 2];
+            }
+        }
     }
 
-    if (infoHeader.biPlanes != 1 || infoHeader.biCompression != BI_RGB || infoHeader.biBitCount != 24)
+    std::cout << "Image loaded: size=" << mSize << std::endl;
+    return true;
+}
+
+bool Image::LoadYCbCr(const char* path, Image& y, Image& cb, Image& cr)
+{
+    BitmapReader bitmap;
+    if (!bitmap.Open(path))
     {
-        std::cout << "Unsupported file format" << std::endl;
+        std::cout << "Failed to load source image" << std::endl;
         return false;
     }
 
-    if (infoHeader.biWidth != infoHeader.biHeight)
+    if (!ValidateBitmapSize(bitmap))
     {
-        std::cout << "Image width and height must be the same" << std::endl;
         return false;
     }
 
-    mSize = infoHeader.biWidth;
-    if ((mSize & (mSize - 1)) != 0)
+    const uint32 size = bitmap.GetWidth();
+    if (!y.Resize(size, 1) || !cb.Resize(size, 1) || !cr.Resize(size, 1))
     {
-        std::cout << "Image dimensions must be power of two" << std::endl;
+        std::cout << "Failed to resize target images" << std::endl;
         return false;
     }
 
-    // create image size bit mask
-    mSizeBits = 0;
+    for (uint32 j = 0; j < size; j++)
     {
-        uint32 i = mSize;
-        while (i >>= 1) ++mSizeBits;
+        const uint32 offset = j * size;
+        ConvertRowToYCbCr(bitmap.GetRow(j), bitmap.GetBytesPerPixel(), size,
+                          y.mData.data() + offset, cb.mData.data() + offset, cr.mData.data() + offset);
     }
-    mSizeMask = (1 << mSizeBits) - 1;
 
-    // read data
-    mData.resize(3 * mSize * mSize);
-    if (fread(mData.data(), 3 * mSize * mSize, 1, file) != 1)
-    {
-        fclose(file);
-        std::cout << "Failed to read image data" << std::endl;
-        return false;
-    }
-    fclose(file);
-
-    mChannels = 3;
-
-    std::cout << "Image loaded: size=" << mSize << std::endl;
+    std::cout << "Image loaded: size=" << size << std::endl;
     return true;
 }
 
 bool Image::Save(const std::string& name) const
 {
-    uint32 dataSize = 3 * mSize * mSize;
-
-    const BitmapFileHeader header =
-    {
-        // BITMAPFILEHEADER
-        {
-            /* bfType */        0x4D42,
-            /* bfSize */        sizeof(BitmapFileHeader) + dataSize,
-            /* bfReserved1 */   0,
-            /* bfReserved2 */   0,
-            /* bfOffBits */     sizeof(BitmapFileHeader),
-        },
-
-        // BITMAPINFOHEADER
-        {
-            sizeof(BITMAPINFOHEADER),
-            (LONG)mSize,
-            (LONG)mSize,
-            1,
-            24,
-            BI_RGB,
-            dataSize,
-            96, 96, 0, 0
-        },
-    };
-
-    FILE* file = fopen(name.c_str(), "wb");
-    if (!file)
+    BitmapWriter bitmap;
+    if (!bitmap.Open(name, mSize, mSize))
     {
-        std::cout << "Failed to open target image '" << name << "': " << stderr << std::endl;
         return false;
     }
 
-    if (fwrite(&header, sizeof(BitmapFileHeader), 1, file) != 1)
+    for (uint32 y = 0; y < mSize; y++)
     {
-        std::cout << "Failed to write bitmap header: " << stderr << std::endl;
-        fclose(file);
-        return false;
-    }
+        const uint8* row = mData.data() + mChannels * y * mSize;
 
-    std::vector<uint8> tmpData;
-    if (mChannels == 3)
-    {
-        tmpData = mData;
-    }
-    else
-    {
-        // extend grayscale to all the RGB channels
-        tmpData.resize(3 * mSize * mSize);
-        for (uint32 i = 0; i < mSize * mSize; ++i)
+        // grayscale is extended to all the RGB channels row by row
+        const bool written = (mChannels == 3) ? bitmap.WriteRow(row) : bitmap.WriteGrayscaleRow(row);
+        if (!written)
         {
-            tmpData[3 * i] = mData[i];
-            tmpData[3 * i + 1] = mData[i];
-            tmpData[3 * i + 2] = mData[i];
+            return false;
         }
     }
 
-    if (fwrite(tmpData.data(), dataSize, 1, file) != 1)
-    {
-        std::cout << "Failed to write bitmap image data: " << stderr << std::endl;
-        fclose(file);
-        return false;
-    }
-
-    fclose(file);
-    return true;
+    return bitmap.Close();
 }
 
 ImageDifference Image::Compare(const Image& imageA, const Image& imageB)
@@ -275,15 +438,9 @@ bool Image::ToYCbCr(Image& y, Image& cb, Image& cr) const
 
     for (uint32 j = 0; j < mSize; j++)
     {
-        for (uint32 i = 0; i < mSize; i++)
-        {
-            uint8 r, g, b;
-            Sample3(i, j, r, g, b);
-
-            y.WritePixel(i, j, CONVERT_RGB2Y(r, g, b));
-            cb.WritePixel(i, j, CONVERT_RGB2Cb(r, g, b));
-            cr.WritePixel(i, j, CONVERT_RGB2Cr(r, g, b));
-        }
+        const uint32 offset = j * mSize;
+        ConvertRowToYCbCr(mData.data() + 3 * offset, 3, mSize,
+                          y.mData.data() + offset, cb.mData.data() + offset, cr.mData.data() + offset);
     }
 
     return true;
@@ -291,33 +448,86 @@ bool Image::ToYCbCr(Image& y, Image& cb, Image& cr) const
 
 bool Image::FromYCbCr(const Image& y, const Image& cb, const Image& cr)
 {
-    assert(y.mSize == cb.mSize);
-    assert(y.mSize == cr.mSize);
-    assert(y.mChannels == 1);
-    assert(cb.mChannels == 1);
-    assert(cr.mChannels == 1);
-
     if (!Resize(y.mSize, 3))
     {
         std::cout << "Failed to resize image" << std::endl;
         return false;
     }
 
-    for (uint32 j = 0; j < mSize; j++)
+    return ConvertFromYCbCr(y, cb, cr, mData.data(), 3 * mSize, 3);
+}
+
+bool Image::ConvertFromYCbCr(const Image& y, const Image& cb, const Image& cr,
+                             uint8* dest, size_t destStride, uint32 bytesPerPixel, ThreadPool* threadPool)
+{
+    uint32 chromaShift;
+    if (!GetChromaShift(y, cb, cr, chromaShift))
     {
-        for (uint32 i = 0; i < mSize; i++)
-        {
-            const uint8 yComp = y.Sample(i, j);
-            const uint8 cbComp = cb.Sample(i, j);
-            const uint8 crComp = cr.Sample(i, j);
+        return false;
+    }
+
+    if (bytesPerPixel != 3 && bytesPerPixel != 4)
+    {
+        std::cout << "Unsupported number of bytes per pixel: " << bytesPerPixel << std::endl;
+        return false;
+    }
 
-            const uint8 r = (uint8)CONVERT_YCbCr2R(yComp, cbComp, crComp);
-            const uint8 g = (uint8)CONVERT_YCbCr2G(yComp, cbComp, crComp);
-            const uint8 b = (uint8)CONVERT_YCbCr2B(yComp, cbComp, crComp);
+    const uint32 size = y.mSize;
+    const uint32 chromaSize = cb.mSize;
 
-            WritePixel3(i, j, r, g, b);
+    const auto convertRows = [&](uint32 firstRow, uint32 lastRow)
+    {
+        for (uint32 j = firstRow; j < lastRow; j++)
+        {
+            const uint32 chromaOffset = (j >> chromaShift) * chromaSize;
+            ConvertRowFromYCbCr(y.mData.data() + j * size, cb.mData.data() + chromaOffset, cr.mData.data() + chromaOffset,
+                                size, chromaShift, bytesPerPixel, dest + j * destStride);
         }
+    };
+
+    if (threadPool)
+    {
+        // few bands per thread, so the load is balanced dynamically
+        const uint32 numBands = std::min<uint32>(size, 4 * threadPool->GetNumThreads());
+        threadPool->ParallelFor(numBands, [&](uint32 band, uint32)
+        {
+            convertRows(band * size / numBands, (band + 1) * size / numBands);
+        });
+    }
+    else
+    {
+        convertRows(0, size);
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+bool Image::SaveYCbCr(const std::string& name, const Image& y, const Image& cb, const Image& cr)
+{
+    uint32 chromaShift;
+    if (!GetChromaShift(y, cb, cr, chromaShift))
+    {
+        return false;
+    }
+
+    BitmapWriter bitmap;
+    if (!bitmap.Open(name, y.mSize, y.mSize))
+    {
+        return false;
+    }
+
+    // pixels are converted directly into the bitmap's row buffer
+    for (uint32 j = 0; j < y.mSize; j++)
+    {
+        const uint32 chromaOffset = (j >> chromaShift) * cb.mSize;
+        ConvertRowFromYCbCr(y.mData.data() + j * y.mSize, cb.mData.data() + chromaOffset, cr.mData.data() + chromaOffset,
+                            y.mSize, chromaShift, 3, bitmap.GetRowBuffer());
+
+        if (!bitmap.WriteRowBuffer())
+        {
+            return false;
+        }
+    }
+
+    return bitmap.Close();
+}
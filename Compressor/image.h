@@ -3,8 +3,11 @@
 #include "common.h"
 
 #include <vector>
+#include <string>
 #include <assert.h>
 
+class ThreadPool;
+
 //////////////////////////////////////////////////////////////////////////
 
 struct ImageDifference
@@ -62,6 +65,9 @@ public:
     // load image from a BMP file
     bool Load(const char* path);
 
+    // load BMP file and decompose it directly into YCbCr images (without intermediate RGB image)
+    static bool LoadYCbCr(const char* path, Image& y, Image& cb, Image& cr);
+
     // save image to a BMP file
     bool Save(const std::string& name) const;
 
@@ -69,8 +75,19 @@ public:
     bool ToYCbCr(Image& y, Image& cb, Image& cr) const;
 
     // convert separate YCbCr images into one RGB image
+    // chroma images can be smaller than the luma image (by a power of two), they are upsampled on the fly
     bool FromYCbCr(const Image& y, const Image& cb, const Image& cr);
 
+    // Convert separate YCbCr images directly into caller's buffer of interleaved pixels: 3 bytes per pixel
+    // (same channel order as RGB images and BMP files) or 4 bytes per pixel (4th byte is 255).
+    // Chroma images can be smaller than the luma image (by a power of two), they are upsampled on the fly.
+    // Rows are stored from the bottom of the picture, 'destStride' bytes apart. Optionally, rows are converted in parallel.
+    static bool ConvertFromYCbCr(const Image& y, const Image& cb, const Image& cr,
+                                 uint8* dest, size_t destStride, uint32 bytesPerPixel, ThreadPool* threadPool = nullptr);
+
+    // save separate YCbCr images directly to a BMP file (without intermediate RGB image)
+    static bool SaveYCbCr(const std::string& name, const Image& y, const Image& cb, const Image& cr);
+
     // compare two images
     static ImageDifference Compare(const Image& imageA, const Image& imageB);
 
@@ -94,6 +111,17 @@ public:
         return mChannels;
     }
 
+    // raw pixel data (row by row)
+    const uint8* GetData() const
+    {
+        return mData.data();
+    }
+
+    uint8* GetData()
+    {
+        return mData.data();
+    }
+
     // get single pixel (monochromatic)
     FORCE_INLINE uint8 Sample(uint32 x, uint32 y) const
     {
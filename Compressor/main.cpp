@@ -1,6 +1,8 @@
-#include "compressor.h"
+#include "color_compressor.h"
+#include "trace.h"
 #include <iostream>
 #include <iomanip>
+#include <chrono>
 
 
 // TODO command line options:
@@ -14,111 +16,87 @@
 
 int main()
 {
-    Image originalImage;
-    if (!originalImage.Load("../Original/lena_512.bmp"))
+    // record timeline of the encoder and decoder work
+    Trace::Enable(true);
+
+    const auto conversionStart = std::chrono::high_resolution_clock::now();
+
+    std::cout << "Loading and decomposing into YCbCr components..." << std::endl;
+    Image yImage, cbImage, crImage;
+    if (!Image::LoadYCbCr("../Original/lena_512.bmp", yImage, cbImage, crImage))
     {
         std::cout << "Failed to load source image" << std::endl;
         return 1;
     }
 
-    std::cout << "Decomposing into YCbCr components..." << std::endl;
-    Image yImage, cbImage, crImage;
-    if (!originalImage.ToYCbCr(yImage, cbImage, crImage))
+    // conversion time is shared by all the channels
+    EncoderTelemetry telemetry[COLOR_NUM_CHANNELS];
+    for (EncoderTelemetry& channelTelemetry : telemetry)
     {
-        std::cout << "Failed to decompose image into YCbCr components" << std::endl;
-        return 2;
+        channelTelemetry.phaseTime[(uint32)EncoderPhase::Conversion] =
+            std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - conversionStart).count();
     }
 
-    std::cout << "Downsampling chroma components..." << std::endl;
-    cbImage = cbImage.Downsample().Downsample();
-    crImage = crImage.Downsample().Downsample();
-
     CompressorSettings lumaSettings;
     lumaSettings.minRangeSize = 8;
     lumaSettings.maxRangeSize = 64;
+    lumaSettings.computeIterationHint = true;
 
     // HACKS
-    CompressorSettings chromaSettings = lumaSettings;
-    chromaSettings.disableImportance = true;
-    chromaSettings.mseMultiplier = 2.70f;
-
-    Compressor compressorY(lumaSettings);
-    Compressor compressorCb(chromaSettings);
-
-    chromaSettings.mseMultiplier = 1.50f;
-    Compressor compressorCr(chromaSettings);
-    
-    std::cout << "Compressing Y channel..." << std::endl;
-    if (!compressorY.Compress(yImage))
-    {
-        std::cout << "Failed to compress Y image" << std::endl;
-        return 1;
-    }
-    compressorY.Save("../Encoded/encodedY.dat");
-    compressorY.SaveAsSourceFile("luma", "../Demo/luma.cpp");
+    CompressorSettings chromaBlueSettings = lumaSettings;
+    chromaBlueSettings.disableImportance = true;
+    chromaBlueSettings.mseMultiplier = 2.70f;
+    chromaBlueSettings.channelSubsampling = 2;
 
-    std::cout << "Compressing Cb channel..." << std::endl;
-    if (!compressorCb.Compress(cbImage))
-    {
-        std::cout << "Failed to compress Cb image" << std::endl;
-        return 1;
-    }
-    compressorCb.Save("../Encoded/encodedCb.dat");
-    compressorCb.SaveAsSourceFile("cb", "../Demo/cb.cpp");
+    CompressorSettings chromaRedSettings = chromaBlueSettings;
+    chromaRedSettings.mseMultiplier = 1.50f;
 
+    ColorCompressor compressor(lumaSettings, chromaBlueSettings, chromaRedSettings);
 
-    std::cout << "Compressing Cr channel..." << std::endl;
-    if (!compressorCr.Compress(crImage))
+    std::cout << "Compressing Y, Cb and Cr channels (chroma downsampled)..." << std::endl;
+    if (!compressor.Compress(yImage, cbImage, crImage, telemetry))
     {
-        std::cout << "Failed to compress Cr image" << std::endl;
+        std::cout << "Failed to compress image" << std::endl;
         return 1;
     }
-    compressorCr.Save("../Encoded/encodedCr.dat");
-    compressorCr.SaveAsSourceFile("cr", "../Demo/cr.cpp");
+    compressor.Save("../Encoded/encoded.dat");
+
+    telemetry[0].SaveJson("../Encoded/telemetryY.json");
+    telemetry[1].SaveJson("../Encoded/telemetryCb.json");
+    telemetry[2].SaveJson("../Encoded/telemetryCr.json");
+    compressor.GetChannel(0).SaveAsSourceFile("luma", "../Demo/luma.cpp");
+    compressor.GetChannel(1).SaveAsSourceFile("cb", "../Demo/cb.cpp");
+    compressor.GetChannel(2).SaveAsSourceFile("cr", "../Demo/cr.cpp");
 
-    
 #ifdef COMPARE_WITH_ORIGINAL
-    std::cout << "Decompressing Y..." << std::endl;
-    Image decompressedY;
-    if (!compressorY.Decompress(decompressedY))
+    DecompressionSettings decompressionSettings;
+    decompressionSettings.inPlace = true;
+    DecompressionStats decompressionStats[COLOR_NUM_CHANNELS];
+
+    // chroma is decoded directly at the luma resolution (it was downsampled twice before compression)
+    std::cout << "Decompressing Y, Cb and Cr..." << std::endl;
+    Image decompressedY, decompressedCb, decompressedCr;
+    if (!compressor.Decompress(decompressedY, decompressedCb, decompressedCr, decompressionSettings, decompressionStats))
     {
-        std::cout << "Failed to decompress Y image" << std::endl;
+        std::cout << "Failed to decompress image" << std::endl;
         return 1;
     }
+    std::cout << "Converged after " << decompressionStats[0].iterations << "/" << decompressionStats[1].iterations
+              << "/" << decompressionStats[2].iterations << " iterations" << std::endl;
     decompressedY.Save("../Encoded/fractal_decompressed_y.bmp");
-
-    std::cout << "Decompressing Cb..." << std::endl;
-    Image decompressedCb;
-    if (!compressorCb.Decompress(decompressedCb))
-    {
-        std::cout << "Failed to decompress Cb image" << std::endl;
-        return 1;
-    }
     decompressedCb.Save("../Encoded/fractal_decompressed_cb.bmp");
-
-    std::cout << "Decompressing Cr..." << std::endl;
-    Image decompressedCr;
-    if (!compressorCr.Decompress(decompressedCr))
-    {
-        std::cout << "Failed to decompress Cr image" << std::endl;
-        return 1;
-    }
     decompressedCr.Save("../Encoded/fractal_decompressed_cr.bmp");
 
-    std::cout << "Upsampling chroma components..." << std::endl;
-    decompressedCb = decompressedCb.Upsample().Upsample();
-    decompressedCr = decompressedCr.Upsample().Upsample();
-
     std::cout << "Merging into RGB components..." << std::endl;
-    Image decompressed;
-    if (!decompressed.FromYCbCr(decompressedY, decompressedCb, decompressedCr))
+    if (!Image::SaveYCbCr("../Encoded/fractal_decompressed.bmp", decompressedY, decompressedCb, decompressedCr))
     {
         return 3;
     }
-    decompressed.Save("../Encoded/fractal_decompressed.bmp");
 
     /*
     std::cout << std::endl << "=== COMPRESSED IMAGE STATS ===" << std::endl;
+    Image decompressed;
+    decompressed.FromYCbCr(decompressedY, decompressedCb, decompressedCr);
     ImageDifference diff = Image::Compare(originalImage, decompressed);
     std::cout << "MSE      = " << std::setw(8) << std::setprecision(4) << diff.averageError << std::endl;
     std::cout << "PSNR     = " << std::setw(8) << std::setprecision(4) << diff.psnr << " dB" << std::endl;
@@ -126,6 +104,10 @@ int main()
     */
 #endif
 
+    Trace::Save("../Encoded/trace.json");
+
+#ifdef _WIN32
     system("pause");
+#endif // _WIN32
     return 0;
 }
@@ -0,0 +1,206 @@
+#include "mapped_file.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // _WIN32
+
+
+MappedFile::MappedFile()
+    : mData(nullptr)
+    , mSize(0)
+    , mBuffered(false)
+#ifdef _WIN32
+    , mFileHandle(INVALID_HANDLE_VALUE)
+    , mMappingHandle(nullptr)
+#endif // _WIN32
+{ }
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* path, size_t minMappedSize)
+{
+    Close();
+
+    mFileHandle = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (mFileHandle == INVALID_HANDLE_VALUE)
+    {
+        std::cout << "Failed to open file '" << path << "'" << std::endl;
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(mFileHandle, &size) || size.QuadPart == 0)
+    {
+        std::cout << "Failed to obtain size of file '" << path << "'" << std::endl;
+        Close();
+        return false;
+    }
+
+    if ((uint64)size.QuadPart < (uint64)minMappedSize)
+    {
+        // size is below minMappedSize, so it fits in a single read
+        mBuffer.resize((size_t)size.QuadPart);
+        DWORD bytesRead = 0;
+        if (!::ReadFile(mFileHandle, mBuffer.data(), (DWORD)mBuffer.size(), &bytesRead, nullptr) || bytesRead != mBuffer.size())
+        {
+            std::cout << "Failed to read file '" << path << "'" << std::endl;
+            Close();
+            return false;
+        }
+
+        ::CloseHandle(mFileHandle);
+        mFileHandle = INVALID_HANDLE_VALUE;
+
+        mData = mBuffer.data();
+        mSize = mBuffer.size();
+        mBuffered = true;
+        return true;
+    }
+
+    mMappingHandle = ::CreateFileMappingA(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mMappingHandle)
+    {
+        std::cout << "Failed to create mapping of file '" << path << "'" << std::endl;
+        Close();
+        return false;
+    }
+
+    mData = static_cast<const uint8*>(::MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!mData)
+    {
+        std::cout << "Failed to map file '" << path << "'" << std::endl;
+        Close();
+        return false;
+    }
+
+    mSize = (size_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mBuffered)
+    {
+        mBuffer.clear();
+        mData = nullptr;
+        mBuffered = false;
+    }
+
+    if (mData)
+    {
+        ::UnmapViewOfFile(mData);
+        mData = nullptr;
+    }
+
+    if (mMappingHandle)
+    {
+        ::CloseHandle(mMappingHandle);
+        mMappingHandle = nullptr;
+    }
+
+    if (mFileHandle != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(mFileHandle);
+        mFileHandle = INVALID_HANDLE_VALUE;
+    }
+
+    mSize = 0;
+}
+
+#else
+
+bool MappedFile::Open(const char* path, size_t minMappedSize)
+{
+    Close();
+
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "Failed to open file '" << path << "'" << std::endl;
+        return false;
+    }
+
+    struct stat fileStat;
+    if (::fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        std::cout << "Failed to obtain size of file '" << path << "'" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    if ((size_t)fileStat.st_size < minMappedSize)
+    {
+        mBuffer.resize((size_t)fileStat.st_size);
+        size_t bytesRead = 0;
+        while (bytesRead < mBuffer.size())
+        {
+            const ssize_t result = ::read(fd, mBuffer.data() + bytesRead, mBuffer.size() - bytesRead);
+            if (result <= 0)
+            {
+                break;
+            }
+            bytesRead += (size_t)result;
+        }
+        ::close(fd);
+
+        if (bytesRead != mBuffer.size())
+        {
+            std::cout << "Failed to read file '" << path << "'" << std::endl;
+            mBuffer.clear();
+            return false;
+        }
+
+        mData = mBuffer.data();
+        mSize = mBuffer.size();
+        mBuffered = true;
+        return true;
+    }
+
+    void* data = ::mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps its own reference to the file
+
+    if (data == MAP_FAILED)
+    {
+        std::cout << "Failed to map file '" << path << "'" << std::endl;
+        return false;
+    }
+
+    ::madvise(data, (size_t)fileStat.st_size, MADV_SEQUENTIAL);
+
+    mData = static_cast<const uint8*>(data);
+    mSize = (size_t)fileStat.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mBuffered)
+    {
+        mBuffer.clear();
+        mData = nullptr;
+        mBuffered = false;
+    }
+
+    if (mData)
+    {
+        ::munmap(const_cast<uint8*>(mData), mSize);
+        mData = nullptr;
+    }
+
+    mSize = 0;
+}
+
+#endif // _WIN32
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.h"
+
+#include <stddef.h>
+#include <vector>
+
+
+// Read-only memory mapping of a whole file
+// (or a copy of the file, if it's too small to be worth mapping)
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    // map file contents into memory
+    // files smaller than 'minMappedSize' are read into a buffer instead - for small files the fixed cost
+    // of the mapping (system calls, page faults) is higher than the cost of the copy
+    bool Open(const char* path, size_t minMappedSize = 0);
+
+    // unmap the file
+    void Close();
+
+    const uint8* GetData() const
+    {
+        return mData;
+    }
+
+    size_t GetSize() const
+    {
+        return mSize;
+    }
+
+private:
+    const uint8* mData;
+    size_t mSize;
+
+    // file contents if the file is not mapped (mData points to the buffer)
+    std::vector<uint8> mBuffer;
+    bool mBuffered;
+
+#ifdef _WIN32
+    void* mFileHandle;
+    void* mMappingHandle;
+#endif // _WIN32
+};
@@ -3,7 +3,9 @@
 #include "common.h"
 
 #include <vector>
+#include <utility>
 #include <assert.h>
+#include <string.h>
 
 
 class QuadtreeCode
@@ -60,6 +62,11 @@ public:
         mCurrentBit = 0;
     }
 
+    uint32 GetCursor() const
+    {
+        return mCurrentBit;
+    }
+
     bool Get()
     {
         assert(mCurrentBit < mBitsUsed);
@@ -72,19 +79,63 @@ public:
         return val != 0;
     }
 
-    void Push(QuadtreeCode& other)
+    // random access to a single bit (does not move the cursor)
+    bool GetBit(uint32 index) const
+    {
+        assert(index < mBitsUsed);
+        return (mCode[index / 32] & ((ElementType)1 << (ElementType)(index % 32))) != 0;
+    }
+
+    // append all the bits of another code (word by word)
+    void Push(const QuadtreeCode& other)
     {
-        other.ResetCursor();
-        for (uint32 i = 0; i < other.GetSize(); ++i)
+        const uint32 numOtherWords = (other.mBitsUsed + 31) / 32;
+        const uint32 firstWord = mBitsUsed / 32;
+        const uint32 shift = mBitsUsed % 32;
+
+        // drop bits past the end of this code
+        mCode.resize((mBitsUsed + 31) / 32);
+        if (shift > 0)
         {
-            Push(other.Get());
+            mCode[firstWord] &= ((ElementType)1 << (ElementType)shift) - 1;
         }
+
+        mCode.resize((mBitsUsed + other.mBitsUsed + 31) / 32, 0);
+        for (uint32 i = 0; i < numOtherWords; ++i)
+        {
+            // bits past the end of the code may be set (see Load)
+            ElementType word = other.mCode[i];
+            const uint32 bitsLeft = other.mBitsUsed - 32 * i;
+            if (bitsLeft < 32)
+            {
+                word &= ((ElementType)1 << (ElementType)bitsLeft) - 1;
+            }
+
+            mCode[firstWord + i] |= word << (ElementType)shift;
+            if (shift > 0 && firstWord + i + 1 < mCode.size())
+            {
+                mCode[firstWord + i + 1] |= word >> (ElementType)(32 - shift);
+            }
+        }
+
+        mBitsUsed += other.mBitsUsed;
     }
 
-    void Load(const std::vector<ElementType>& code, uint32 numBits)
+    // load 'numBits' bits from words stored in the host byte order (may be unaligned)
+    // NOTE: only the legacy files store the words this way, container words are little-endian (see Compressor::LoadChannel)
+    void Load(const uint8* code, uint32 numBits)
     {
-        assert(code.size() * sizeof(ElementType) * 8 >= numBits);
-        mCode = code;
+        mCode.resize((numBits + 31) / 32);
+        memcpy(mCode.data(), code, mCode.size() * sizeof(ElementType));
+        mBitsUsed = numBits;
+        mCurrentBit = 0;
+    }
+
+    // take over (numBits + 31) / 32 words already converted to the host byte order
+    void Load(std::vector<ElementType>&& words, uint32 numBits)
+    {
+        assert(words.size() == ((uint64)numBits + 31) / 32);
+        mCode = std::move(words);
         mBitsUsed = numBits;
         mCurrentBit = 0;
     }
@@ -94,3 +145,43 @@ private:
     uint32 mBitsUsed;
     uint32 mCurrentBit; // cursor position
 };
+
+/**
+* Read-only random access to split flags stored elsewhere - in a QuadtreeCode or in raw words
+* referenced in place (e.g. a mapped file, see CompressedImageView).
+* NOTE: does not own the words, they must outlive the view
+*/
+class QuadtreeCodeView
+{
+public:
+    QuadtreeCodeView()
+        : mWords(nullptr)
+        , mNumBits(0)
+    { }
+
+    QuadtreeCodeView(const QuadtreeCode& code)
+        : mWords(code.GetCode().data())
+        , mNumBits(code.GetSize())
+    { }
+
+    // 'words' - (numBits + 31) / 32 words in the QuadtreeCode bit order
+    QuadtreeCodeView(const QuadtreeCode::ElementType* words, uint32 numBits)
+        : mWords(words)
+        , mNumBits(numBits)
+    { }
+
+    uint32 GetSize() const
+    {
+        return mNumBits;
+    }
+
+    bool GetBit(uint32 index) const
+    {
+        assert(index < mNumBits);
+        return (mWords[index / 32] & ((QuadtreeCode::ElementType)1 << (QuadtreeCode::ElementType)(index % 32))) != 0;
+    }
+
+private:
+    const QuadtreeCode::ElementType* mWords;
+    uint32 mNumBits;
+};
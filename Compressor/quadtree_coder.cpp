@@ -0,0 +1,247 @@
+#include "quadtree_coder.h"
+#include "rans.h"
+
+#include <iostream>
+#include <algorithm>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+// maximum number of quadtree levels with split flags
+#define QUADTREE_CODER_MAX_LEVELS 16
+
+// adaptation rate of the split probabilities (higher is slower)
+#define QUADTREE_CODER_ADAPTATION_SHIFT 4
+
+namespace {
+
+// subdivision of a neighbouring range, relative to the coded range
+enum NeighbourState
+{
+    NeighbourNone,      // outside of the image
+    NeighbourCoarser,   // larger leaf
+    NeighbourEqual,     // leaf of the same size
+    NeighbourFiner,     // subdivided further
+
+    NumNeighbourStates
+};
+
+// split flag contexts shared by the encoder and the decoder
+// NOTE: parent of every coded range (except root ranges) is split, so the depth covers the parent decision
+class SplitModel
+{
+public:
+    bool Init(uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize)
+    {
+        if (minRangeSize == 0 || maxRangeSize < minRangeSize || imageSize < maxRangeSize)
+        {
+            return false;
+        }
+
+        uint32 numLevels = 1;
+        while ((minRangeSize << (numLevels - 1)) < maxRangeSize)
+            numLevels++;
+
+        if (numLevels > QUADTREE_CODER_MAX_LEVELS)
+        {
+            return false;
+        }
+
+        mImageSize = imageSize;
+        mMinRangeSize = minRangeSize;
+        mMaxRangeSize = maxRangeSize;
+        mCellsPerRow = imageSize / minRangeSize;
+        mLeafLevels.assign(mCellsPerRow * mCellsPerRow, 0);
+
+        for (uint16& zeroFrequency : mZeroFrequencies)
+        {
+            zeroFrequency = RANS_PROB_SCALE / 2;
+        }
+
+        return true;
+    }
+
+    // visit all the split flags in the quadtree order
+    // 'codeFlag(zeroFrequency, outFlag)' codes single flag, returns false on failure
+    template<typename CodeFlag>
+    bool Traverse(CodeFlag& codeFlag)
+    {
+        for (uint32 ry0 = 0; ry0 + mMaxRangeSize <= mImageSize; ry0 += mMaxRangeSize)
+        {
+            for (uint32 rx0 = 0; rx0 + mMaxRangeSize <= mImageSize; rx0 += mMaxRangeSize)
+            {
+                if (!CodeRange(rx0, ry0, mMaxRangeSize, 0, codeFlag))
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+private:
+    FORCE_INLINE NeighbourState GetNeighbourState(uint32 cellIndex, uint32 level) const
+    {
+        const uint32 leafLevel = mLeafLevels[cellIndex];
+        if (leafLevel < level)
+            return NeighbourCoarser;
+        if (leafLevel == level)
+            return NeighbourEqual;
+        return NeighbourFiner;
+    }
+
+    FORCE_INLINE uint32 GetContext(uint32 rx0, uint32 ry0, uint32 level) const
+    {
+        // left and upper neighbours precede the range in the quadtree order, so their leaves are known
+        const uint32 cx = rx0 / mMinRangeSize;
+        const uint32 cy = ry0 / mMinRangeSize;
+        const NeighbourState left = cx > 0 ? GetNeighbourState(cy * mCellsPerRow + cx - 1, level) : NeighbourNone;
+        const NeighbourState top = cy > 0 ? GetNeighbourState((cy - 1) * mCellsPerRow + cx, level) : NeighbourNone;
+        return (level * NumNeighbourStates + left) * NumNeighbourStates + top;
+    }
+
+    template<typename CodeFlag>
+    bool CodeRange(uint32 rx0, uint32 ry0, uint32 rangeSize, uint32 level, CodeFlag& codeFlag)
+    {
+        bool subdivide = false;
+        if (rangeSize > mMinRangeSize)
+        {
+            uint16& zeroFrequency = mZeroFrequencies[GetContext(rx0, ry0, level)];
+            if (!codeFlag((uint32)zeroFrequency, subdivide))
+            {
+                return false;
+            }
+
+            if (subdivide)
+                zeroFrequency = (uint16)(zeroFrequency - (zeroFrequency >> QUADTREE_CODER_ADAPTATION_SHIFT));
+            else
+                zeroFrequency = (uint16)(zeroFrequency + ((RANS_PROB_SCALE - zeroFrequency) >> QUADTREE_CODER_ADAPTATION_SHIFT));
+        }
+
+        if (subdivide)
+        {
+            const uint32 subRangeSize = rangeSize / 2;
+            return CodeRange(rx0,                   ry0,                    subRangeSize, level + 1, codeFlag) &&
+                   CodeRange(rx0 + subRangeSize,    ry0,                    subRangeSize, level + 1, codeFlag) &&
+                   CodeRange(rx0,                   ry0 + subRangeSize,     subRangeSize, level + 1, codeFlag) &&
+                   CodeRange(rx0 + subRangeSize,    ry0 + subRangeSize,     subRangeSize, level + 1, codeFlag);
+        }
+
+        // mark the leaf cells
+        const uint32 cx0 = rx0 / mMinRangeSize;
+        const uint32 cy0 = ry0 / mMinRangeSize;
+        const uint32 numCells = rangeSize / mMinRangeSize;
+        for (uint32 cy = cy0; cy < cy0 + numCells; ++cy)
+        {
+            std::fill_n(mLeafLevels.begin() + cy * mCellsPerRow + cx0, numCells, (uint8)level);
+        }
+
+        return true;
+    }
+
+    uint32 mImageSize;
+    uint32 mMinRangeSize;
+    uint32 mMaxRangeSize;
+    uint32 mCellsPerRow;
+    std::vector<uint8> mLeafLevels; // level of the leaf covering each minimum range
+    uint16 mZeroFrequencies[QUADTREE_CODER_MAX_LEVELS * NumNeighbourStates * NumNeighbourStates];
+};
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+bool QuadtreeCoder::Encode(const QuadtreeCode& code, uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize,
+                           std::vector<uint8>& outData)
+{
+    SplitModel model;
+    if (!model.Init(imageSize, minRangeSize, maxRangeSize))
+    {
+        std::cout << "Invalid quadtree geometry" << std::endl;
+        return false;
+    }
+
+    // probabilities adapt in the decoding order, but rANS works as a stack, so the flags are recorded first
+    struct FlagRange
+    {
+        uint16 start;
+        uint16 frequency;
+    };
+    std::vector<FlagRange> ranges;
+    ranges.reserve(code.GetSize());
+
+    QuadtreeCode sourceCode(code);
+    sourceCode.ResetCursor();
+
+    const auto recordFlag = [&](uint32 zeroFrequency, bool& outFlag) -> bool
+    {
+        if (sourceCode.GetCursor() >= sourceCode.GetSize())
+        {
+            return false;
+        }
+
+        outFlag = sourceCode.Get();
+        FlagRange range;
+        range.start = (uint16)(outFlag ? zeroFrequency : 0);
+        range.frequency = (uint16)(outFlag ? RANS_PROB_SCALE - zeroFrequency : zeroFrequency);
+        ranges.push_back(range);
+        return true;
+    };
+
+    if (!model.Traverse(recordFlag) || sourceCode.GetCursor() != sourceCode.GetSize())
+    {
+        std::cout << "Quadtree does not match the image geometry" << std::endl;
+        return false;
+    }
+
+    std::vector<uint8> reversedOutput;
+    reversedOutput.reserve(ranges.size() / 4);
+
+    RansEncoder encoder;
+    for (size_t i = ranges.size(); i-- > 0; )
+    {
+        encoder.Put(ranges[i].start, ranges[i].frequency, reversedOutput);
+    }
+    encoder.Flush(reversedOutput);
+
+    RansEncoder::Finish(reversedOutput, outData);
+    return true;
+}
+
+bool QuadtreeCoder::Decode(const uint8* data, size_t dataSize, uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize,
+                           uint32 numFlags, QuadtreeCode& outCode)
+{
+    const uint8* dataEnd = data + dataSize;
+
+    SplitModel model;
+    RansDecoder decoder;
+    if (!model.Init(imageSize, minRangeSize, maxRangeSize) || !decoder.Init(data, dataEnd))
+    {
+        std::cout << "Corrupted quadtree data" << std::endl;
+        return false;
+    }
+
+    outCode.Clear();
+
+    const auto decodeFlag = [&](uint32 zeroFrequency, bool& outFlag) -> bool
+    {
+        if (outCode.GetSize() >= numFlags)
+        {
+            return false;
+        }
+
+        outFlag = decoder.GetBit(zeroFrequency, data, dataEnd);
+        outCode.Push(outFlag);
+        return true;
+    };
+
+    // all the data must be consumed and the state must end where the encoder started
+    if (!model.Traverse(decodeFlag) || outCode.GetSize() != numFlags || !decoder.IsFinished() || data != dataEnd)
+    {
+        std::cout << "Corrupted quadtree data" << std::endl;
+        return false;
+    }
+
+    return true;
+}
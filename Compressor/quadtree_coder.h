@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+#include "quadtree.h"
+
+#include <vector>
+
+
+/**
+* Entropy coder of the quadtree split flags.
+* Every flag is coded with an adaptive binary rANS model selected by the range depth and by the
+* subdivision of the left and upper neighbouring ranges (both are already decoded in the quadtree order).
+* The number of root ranges follows from the image size, so the flags count is not stored.
+*/
+class QuadtreeCoder
+{
+public:
+    // append compressed split flags to 'outData'
+    static bool Encode(const QuadtreeCode& code, uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize,
+                       std::vector<uint8>& outData);
+
+    // decompress split flags, fails if the data is corrupted or does not contain exactly 'numFlags' flags
+    static bool Decode(const uint8* data, size_t dataSize, uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize,
+                       uint32 numFlags, QuadtreeCode& outCode);
+};
@@ -0,0 +1,78 @@
+#include "quadtree_index.h"
+
+#include <functional>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+bool QuadtreeIndex::Build(const QuadtreeCodeView& code, uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize)
+{
+    mRows.clear();
+    if (minRangeSize == 0 || maxRangeSize < minRangeSize || imageSize < maxRangeSize)
+    {
+        return false;
+    }
+
+    Row position = { 0, 0 };
+
+    std::function<bool(uint32)> walkRange;
+    walkRange = [&](uint32 rangeSize) -> bool
+    {
+        bool subdivide = false;
+        if (rangeSize > minRangeSize)
+        {
+            if (position.flagOffset >= code.GetSize())
+            {
+                return false;
+            }
+            subdivide = code.GetBit(position.flagOffset++);
+        }
+
+        if (subdivide)
+        {
+            const uint32 subRangeSize = rangeSize / 2;
+            return walkRange(subRangeSize) && walkRange(subRangeSize) && walkRange(subRangeSize) && walkRange(subRangeSize);
+        }
+
+        position.domainIndex++;
+        return true;
+    };
+
+    const uint32 numRootRanges = imageSize / maxRangeSize;
+    for (uint32 row = 0; row < numRootRanges; ++row)
+    {
+        mRows.push_back(position);
+        for (uint32 i = 0; i < numRootRanges; ++i)
+        {
+            if (!walkRange(maxRangeSize))
+            {
+                mRows.clear();
+                return false;
+            }
+        }
+    }
+    mRows.push_back(position);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool QuadtreeIndexView::IsConsistent(uint32 numFlags, uint32 numDomains) const
+{
+    if (IsEmpty() || mRows[0].flagOffset != 0 || mRows[0].domainIndex != 0 ||
+        mRows[mNumRows].flagOffset != numFlags || mRows[mNumRows].domainIndex != numDomains)
+    {
+        return false;
+    }
+
+    for (uint32 i = 0; i < mNumRows; ++i)
+    {
+        if (mRows[i + 1].flagOffset < mRows[i].flagOffset || mRows[i + 1].domainIndex < mRows[i].domainIndex)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "common.h"
+#include "quadtree.h"
+
+#include <vector>
+#include <assert.h>
+
+
+/**
+* Index of the quadtree split flags: position of the first split flag and the first domain of every
+* row of root range blocks. Rows can be parsed independently of each other (e.g. in parallel, or only
+* the rows covering a region), without walking all the preceding flags.
+* NOTE: the offsets refer to the raw split flags (QuadtreeCode) and domains. The index is stored only in the
+* raw file layout (see Compressor::SaveRaw) - the entropy coded split flags and domains are single streams
+* (one rANS state, adaptive models), so they are not seekable and the index is rebuilt once they are decoded.
+*/
+class QuadtreeIndex
+{
+public:
+    struct Row
+    {
+        uint32 flagOffset;
+        uint32 domainIndex;
+    };
+
+    // build the index by walking the split flags
+    bool Build(const QuadtreeCodeView& code, uint32 imageSize, uint32 minRangeSize, uint32 maxRangeSize);
+
+    // append a row (while encoding), the rows are followed by the terminating entry
+    void AddRow(uint32 flagOffset, uint32 domainIndex)
+    {
+        mRows.push_back({ flagOffset, domainIndex });
+    }
+
+    void Clear()
+    {
+        mRows.clear();
+    }
+
+    uint32 GetNumRows() const
+    {
+        return mRows.empty() ? 0 : (uint32)mRows.size() - 1;
+    }
+
+    // number of quadtree leaves (every leaf has one domain)
+    uint32 GetNumDomains() const
+    {
+        return mRows.empty() ? 0 : mRows.back().domainIndex;
+    }
+
+    // rows and a terminating entry (total number of flags and domains)
+    const std::vector<Row>& GetRows() const
+    {
+        return mRows;
+    }
+
+private:
+    std::vector<Row> mRows;
+};
+
+static_assert(sizeof(QuadtreeIndex::Row) == 2 * sizeof(uint32), "Index rows are stored as pairs of 32-bit words");
+
+/**
+* Read-only access to index rows stored elsewhere - in a QuadtreeIndex or referenced in place (e.g. a mapped
+* file, see CompressedImageView).
+* NOTE: does not own the rows, they must outlive the view
+*/
+class QuadtreeIndexView
+{
+public:
+    QuadtreeIndexView()
+        : mRows(nullptr)
+        , mNumRows(0)
+    { }
+
+    QuadtreeIndexView(const QuadtreeIndex& index)
+        : mRows(index.GetRows().empty() ? nullptr : index.GetRows().data())
+        , mNumRows(index.GetNumRows())
+    { }
+
+    // 'rows' - numRows rows and the terminating entry
+    QuadtreeIndexView(const QuadtreeIndex::Row* rows, uint32 numRows)
+        : mRows(rows)
+        , mNumRows(numRows)
+    { }
+
+    bool IsEmpty() const
+    {
+        return mRows == nullptr;
+    }
+
+    uint32 GetNumRows() const
+    {
+        return mNumRows;
+    }
+
+    // row 'index' (index == GetNumRows() is the terminating entry)
+    const QuadtreeIndex::Row& operator [] (uint32 index) const
+    {
+        assert(index <= mNumRows);
+        return mRows[index];
+    }
+
+    // check that the rows are ordered and span exactly 'numFlags' split flags and 'numDomains' domains
+    // NOTE: whether every row really ends where the next one starts is checked by parsing the rows (see DecodePlan::Build)
+    bool IsConsistent(uint32 numFlags, uint32 numDomains) const;
+
+private:
+    const QuadtreeIndex::Row* mRows;
+    uint32 mNumRows;
+};
@@ -0,0 +1,89 @@
+#include "rans.h"
+
+#include <algorithm>
+#include <string.h>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+bool RansModel::Build(const uint32* counts, uint32 numSymbols)
+{
+    assert(numSymbols > 0 && numSymbols <= RANS_MAX_SYMBOLS);
+    mNumSymbols = numSymbols;
+
+    uint64 total = 0;
+    for (uint32 i = 0; i < numSymbols; ++i)
+    {
+        total += counts[i];
+    }
+
+    if (total == 0)
+    {
+        // nothing to encode - any valid table will do
+        for (uint32 i = 0; i < numSymbols; ++i)
+        {
+            mFrequencies[i] = 0;
+        }
+        mFrequencies[0] = RANS_PROB_SCALE;
+        Finalize();
+        return true;
+    }
+
+    uint32 sum = 0;
+    for (uint32 i = 0; i < numSymbols; ++i)
+    {
+        uint32 frequency = 0;
+        if (counts[i] > 0)
+        {
+            frequency = std::max<uint32>(1, (uint32)(((uint64)counts[i] * RANS_PROB_SCALE) / total));
+        }
+        mFrequencies[i] = (uint16)frequency;
+        sum += frequency;
+    }
+
+    // fix rounding errors - the most frequent symbol is adjusted, where it costs the least
+    while (sum != RANS_PROB_SCALE)
+    {
+        uint32 largest = 0;
+        for (uint32 i = 1; i < numSymbols; ++i)
+        {
+            if (mFrequencies[i] > mFrequencies[largest])
+                largest = i;
+        }
+
+        if (sum < RANS_PROB_SCALE)
+        {
+            mFrequencies[largest] = (uint16)(mFrequencies[largest] + (RANS_PROB_SCALE - sum));
+            sum = RANS_PROB_SCALE;
+        }
+        else
+        {
+            if (mFrequencies[largest] <= 1)
+            {
+                // more used symbols than probability slots
+                return false;
+            }
+
+            // take at most half of the largest frequency at once
+            const uint32 taken = std::min<uint32>(sum - RANS_PROB_SCALE, mFrequencies[largest] / 2);
+            mFrequencies[largest] = (uint16)(mFrequencies[largest] - taken);
+            sum -= taken;
+        }
+    }
+
+    Finalize();
+    return true;
+}
+
+void RansModel::Finalize()
+{
+    uint32 start = 0;
+    for (uint32 i = 0; i < mNumSymbols; ++i)
+    {
+        mStarts[i] = (uint16)start;
+        memset(mSlotSymbols + start, (int)i, mFrequencies[i]);
+        start += mFrequencies[i];
+    }
+
+    assert(start == RANS_PROB_SCALE);
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+#include <assert.h>
+
+
+// precision of the symbol probabilities (frequencies sum up to 1 << RANS_PROB_BITS)
+#define RANS_PROB_BITS 12
+#define RANS_PROB_SCALE (1 << RANS_PROB_BITS)
+
+// lower bound of the normalized coder state (byte-wise renormalization)
+#define RANS_STATE_LOWER_BOUND (1u << 23)
+
+// maximum number of symbols in a model
+#define RANS_MAX_SYMBOLS 256
+
+//////////////////////////////////////////////////////////////////////////
+
+/**
+* Symbol frequency table of the rANS coder.
+*/
+class RansModel
+{
+public:
+    RansModel()
+        : mNumSymbols(0)
+    { }
+
+    // normalize symbol counts to the probability scale (every used symbol gets nonzero frequency)
+    bool Build(const uint32* counts, uint32 numSymbols);
+
+    uint32 GetNumSymbols() const
+    {
+        return mNumSymbols;
+    }
+
+    uint32 GetFrequency(uint32 symbol) const
+    {
+        return mFrequencies[symbol];
+    }
+
+    uint32 GetStart(uint32 symbol) const
+    {
+        return mStarts[symbol];
+    }
+
+    // symbol owning given cumulative frequency slot
+    uint32 GetSymbol(uint32 slot) const
+    {
+        return mSlotSymbols[slot];
+    }
+
+private:
+    // build cumulative frequencies and slot lookup table
+    void Finalize();
+
+    uint32 mNumSymbols;
+    uint16 mFrequencies[RANS_MAX_SYMBOLS];
+    uint16 mStarts[RANS_MAX_SYMBOLS];
+    uint8 mSlotSymbols[RANS_PROB_SCALE];
+};
+
+/**
+* rANS encoder state (32-bit, byte-wise renormalization).
+* Symbols must be encoded in reverse order. Bytes are emitted in reverse as well - the output
+* buffer is reversed once all the states are flushed (see RansEncoder::Finish).
+*/
+class RansEncoder
+{
+public:
+    RansEncoder()
+        : mState(RANS_STATE_LOWER_BOUND)
+    { }
+
+    FORCE_INLINE void Put(const RansModel& model, uint32 symbol, std::vector<uint8>& reversedOutput)
+    {
+        Put(model.GetStart(symbol), model.GetFrequency(symbol), reversedOutput);
+    }
+
+    // encode symbol occupying [start, start + frequency) probability range
+    FORCE_INLINE void Put(uint32 start, uint32 frequency, std::vector<uint8>& reversedOutput)
+    {
+        assert(frequency > 0);
+
+        // renormalize, so the state stays within [L, L * 256) after encoding
+        const uint32 maxState = ((RANS_STATE_LOWER_BOUND >> RANS_PROB_BITS) << 8) * frequency;
+        while (mState >= maxState)
+        {
+            reversedOutput.push_back((uint8)(mState & 0xFF));
+            mState >>= 8;
+        }
+
+        mState = ((mState / frequency) << RANS_PROB_BITS) + (mState % frequency) + start;
+    }
+
+    // write the final state (read back by RansDecoder::Init)
+    void Flush(std::vector<uint8>& reversedOutput)
+    {
+        reversedOutput.push_back((uint8)(mState >> 24));
+        reversedOutput.push_back((uint8)(mState >> 16));
+        reversedOutput.push_back((uint8)(mState >> 8));
+        reversedOutput.push_back((uint8)(mState));
+    }
+
+    // reverse the emitted bytes and append them to the output
+    static void Finish(const std::vector<uint8>& reversedOutput, std::vector<uint8>& outData)
+    {
+        outData.insert(outData.end(), reversedOutput.rbegin(), reversedOutput.rend());
+    }
+
+private:
+    uint32 mState;
+};
+
+/**
+* rANS decoder state.
+* NOTE: reads past the end of the stream are reported by IsFinished(), so the decoding loop does not
+* have to check every symbol.
+*/
+class RansDecoder
+{
+public:
+    RansDecoder()
+        : mState(0)
+    { }
+
+    bool Init(const uint8*& data, const uint8* dataEnd)
+    {
+        if (dataEnd - data < 4)
+        {
+            return false;
+        }
+
+        mState = (uint32)data[0] | ((uint32)data[1] << 8) | ((uint32)data[2] << 16) | ((uint32)data[3] << 24);
+        data += 4;
+        return mState >= RANS_STATE_LOWER_BOUND;
+    }
+
+    FORCE_INLINE uint32 Get(const RansModel& model, const uint8*& data, const uint8* dataEnd)
+    {
+        const uint32 slot = mState & (RANS_PROB_SCALE - 1);
+        const uint32 symbol = model.GetSymbol(slot);
+        mState = model.GetFrequency(symbol) * (mState >> RANS_PROB_BITS) + slot - model.GetStart(symbol);
+
+        // renormalize
+        while (mState < RANS_STATE_LOWER_BOUND)
+        {
+            if (data >= dataEnd)
+            {
+                // corrupted stream - zero state decodes the first symbol forever
+                mState = 0;
+                return symbol;
+            }
+            mState = (mState << 8) | *data++;
+        }
+
+        return symbol;
+    }
+
+    // decode binary symbol, 'zeroFrequency' is the probability of zero (scaled by RANS_PROB_SCALE)
+    FORCE_INLINE bool GetBit(uint32 zeroFrequency, const uint8*& data, const uint8* dataEnd)
+    {
+        const uint32 slot = mState & (RANS_PROB_SCALE - 1);
+        const bool bit = slot >= zeroFrequency;
+        if (bit)
+            mState = (RANS_PROB_SCALE - zeroFrequency) * (mState >> RANS_PROB_BITS) + slot - zeroFrequency;
+        else
+            mState = zeroFrequency * (mState >> RANS_PROB_BITS) + slot;
+
+        while (mState < RANS_STATE_LOWER_BOUND)
+        {
+            if (data >= dataEnd)
+            {
+                mState = 0;
+                return bit;
+            }
+            mState = (mState << 8) | *data++;
+        }
+
+        return bit;
+    }
+
+    // all the symbols are decoded - the state is back at the initial encoder state
+    bool IsFinished() const
+    {
+        return mState == RANS_STATE_LOWER_BOUND;
+    }
+
+private:
+    uint32 mState;
+};
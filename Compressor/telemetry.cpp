@@ -0,0 +1,175 @@
+#include "telemetry.h"
+
+#include <iostream>
+#include <fstream>
+#include <assert.h>
+#include <string.h>
+
+
+namespace {
+
+const char* GetPhaseName(EncoderPhase phase)
+{
+    switch (phase)
+    {
+    case EncoderPhase::Conversion:  return "conversion";
+    case EncoderPhase::Search:      return "search";
+    case EncoderPhase::Merge:       return "merge";
+    case EncoderPhase::Stats:       return "stats";
+    default:                        return "unknown";
+    }
+}
+
+template<typename T>
+void WriteJsonArray(std::ostream& stream, const T* values, uint32 count)
+{
+    stream << "[";
+    for (uint32 i = 0; i < count; ++i)
+    {
+        stream << (i > 0 ? ", " : "") << values[i];
+    }
+    stream << "]";
+}
+
+void WriteThreadStatsJson(std::ostream& stream, const EncoderThreadStats& stats, uint32 numLevels, const char* indent)
+{
+    stream << "{\n";
+    stream << indent << "  \"candidates_evaluated\": " << stats.candidatesEvaluated << ",\n";
+    stream << indent << "  \"early_outs\": " << stats.earlyOuts << ",\n";
+    stream << indent << "  \"root_ranges\": " << stats.rootRanges << ",\n";
+    stream << indent << "  \"busy_time_sec\": " << stats.busyTime << ",\n";
+    stream << indent << "  \"idle_time_sec\": " << stats.idleTime << ",\n";
+    stream << indent << "  \"searches_per_level\": ";
+    WriteJsonArray(stream, stats.searches, numLevels);
+    stream << ",\n" << indent << "  \"splits_per_level\": ";
+    WriteJsonArray(stream, stats.splits, numLevels);
+    stream << ",\n" << indent << "  \"leaves_per_level\": ";
+    WriteJsonArray(stream, stats.leaves, numLevels);
+    stream << ",\n" << indent << "  \"mse_histogram_per_level\": [";
+    for (uint32 level = 0; level < numLevels; ++level)
+    {
+        stream << (level > 0 ? ", " : "");
+        WriteJsonArray(stream, stats.mseHistogram[level], TELEMETRY_MSE_BUCKETS);
+    }
+    stream << "]\n" << indent << "}";
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+EncoderThreadStats::EncoderThreadStats()
+    : candidatesEvaluated(0)
+    , earlyOuts(0)
+    , rootRanges(0)
+    , busyTime(0.0)
+    , idleTime(0.0)
+{
+    memset(searches, 0, sizeof(searches));
+    memset(splits, 0, sizeof(splits));
+    memset(leaves, 0, sizeof(leaves));
+    memset(mseHistogram, 0, sizeof(mseHistogram));
+}
+
+void EncoderThreadStats::AddSearch(uint32 level, float mse)
+{
+    assert(level < TELEMETRY_MAX_LEVELS);
+
+    // logarithmic bucket
+    uint32 bucket = 0;
+    uint32 value = (uint32)std::min<float>(mse + 1.0f, 1.0e9f);
+    while (value >>= 1)
+        ++bucket;
+
+    searches[level]++;
+    mseHistogram[level][std::min<uint32>(bucket, TELEMETRY_MSE_BUCKETS - 1)]++;
+}
+
+void EncoderThreadStats::Merge(const EncoderThreadStats& other)
+{
+    candidatesEvaluated += other.candidatesEvaluated;
+    earlyOuts += other.earlyOuts;
+    rootRanges += other.rootRanges;
+    busyTime += other.busyTime;
+    idleTime += other.idleTime;
+
+    for (uint32 level = 0; level < TELEMETRY_MAX_LEVELS; ++level)
+    {
+        searches[level] += other.searches[level];
+        splits[level] += other.splits[level];
+        leaves[level] += other.leaves[level];
+
+        for (uint32 i = 0; i < TELEMETRY_MSE_BUCKETS; ++i)
+        {
+            mseHistogram[level][i] += other.mseHistogram[level][i];
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+EncoderTelemetry::EncoderTelemetry()
+    : imageSize(0)
+    , minRangeSize(0)
+    , maxRangeSize(0)
+    , numLevels(0)
+{
+    for (uint32 i = 0; i < (uint32)EncoderPhase::Count; ++i)
+    {
+        phaseTime[i] = 0.0;
+    }
+}
+
+void EncoderTelemetry::WriteJson(std::ostream& stream) const
+{
+    stream << "{\n";
+    stream << "  \"image_size\": " << imageSize << ",\n";
+    stream << "  \"min_range_size\": " << minRangeSize << ",\n";
+    stream << "  \"max_range_size\": " << maxRangeSize << ",\n";
+    stream << "  \"num_levels\": " << numLevels << ",\n";
+
+    stream << "  \"phase_time_sec\": {";
+    for (uint32 i = 0; i < (uint32)EncoderPhase::Count; ++i)
+    {
+        stream << (i > 0 ? ", " : " ") << "\"" << GetPhaseName((EncoderPhase)i) << "\": " << phaseTime[i];
+    }
+    stream << " },\n";
+
+    stream << "  \"domains\": { "
+        << "\"average_scale\": " << domainsStats.averageScale
+        << ", \"scale_variance\": " << domainsStats.scaleVariance
+        << ", \"min_scale\": " << domainsStats.minScale
+        << ", \"max_scale\": " << domainsStats.maxScale
+        << ", \"average_offset\": " << domainsStats.averageOffset
+        << ", \"offset_variance\": " << domainsStats.offsetVariance
+        << ", \"min_offset\": " << domainsStats.minOffset
+        << ", \"max_offset\": " << domainsStats.maxOffset
+        << ", \"transform_distribution\": ";
+    WriteJsonArray(stream, domainsStats.transformDistribution, 8);
+    stream << " },\n";
+
+    stream << "  \"totals\": ";
+    WriteThreadStatsJson(stream, totals, numLevels, "  ");
+    stream << ",\n";
+
+    stream << "  \"threads\": [";
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        stream << (i > 0 ? ", " : "\n    ");
+        WriteThreadStatsJson(stream, threads[i], numLevels, "    ");
+    }
+    stream << "\n  ]\n}\n";
+}
+
+bool EncoderTelemetry::SaveJson(const std::string& name) const
+{
+    std::ofstream file(name);
+    if (!file.good())
+    {
+        std::cout << "Failed to open telemetry file '" << name << "'" << std::endl;
+        return false;
+    }
+
+    WriteJson(file);
+    return file.good();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+#include "domain.h"
+
+#include <vector>
+#include <string>
+#include <ostream>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+// maximum number of quadtree levels tracked (max range size / min range size <= 2^7)
+#define TELEMETRY_MAX_LEVELS        8
+
+// number of MSE histogram buckets (bucket N holds MSE in [2^N - 1, 2^(N+1) - 1) range)
+#define TELEMETRY_MSE_BUCKETS       16
+
+enum class EncoderPhase : uint32
+{
+    Conversion,     // color conversion and downsampling (measured by the caller)
+    Search,         // domain search (all the worker threads)
+    Merge,          // appending root ranges to the output in the raster order (overlaps the search)
+    Stats,          // domain statistics
+
+    Count
+};
+
+// Counters collected by a single encoder thread
+struct EncoderThreadStats
+{
+    uint64 candidatesEvaluated;                 // number of domain-range comparisons
+    uint64 earlyOuts;                           // comparisons aborted before calculating full MSE
+    uint32 rootRanges;                          // number of compressed root range blocks
+
+    // per quadtree level (level 0 = max range size)
+    uint32 searches[TELEMETRY_MAX_LEVELS];
+    uint32 splits[TELEMETRY_MAX_LEVELS];
+    uint32 leaves[TELEMETRY_MAX_LEVELS];
+    uint32 mseHistogram[TELEMETRY_MAX_LEVELS][TELEMETRY_MSE_BUCKETS];
+
+    double busyTime;    // time spent compressing root ranges (in seconds)
+    double idleTime;    // time spent waiting for other threads (in seconds)
+
+    EncoderThreadStats();
+
+    // register result of a domain search
+    void AddSearch(uint32 level, float mse);
+
+    // accumulate other thread's counters
+    void Merge(const EncoderThreadStats& other);
+};
+
+// Encoder telemetry returned from Compressor::Compress
+struct EncoderTelemetry
+{
+    uint32 imageSize;
+    uint32 minRangeSize;
+    uint32 maxRangeSize;
+    uint32 numLevels;
+
+    // accumulated over all the threads
+    EncoderThreadStats totals;
+    std::vector<EncoderThreadStats> threads;
+
+    // wall time of each phase (in seconds)
+    double phaseTime[(uint32)EncoderPhase::Count];
+
+    DomainsStats domainsStats;
+
+    EncoderTelemetry();
+
+    // write as JSON object
+    void WriteJson(std::ostream& stream) const;
+
+    // save as JSON file
+    bool SaveJson(const std::string& name) const;
+};
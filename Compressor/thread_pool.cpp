@@ -0,0 +1,121 @@
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <algorithm>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+ThreadPool::ThreadPool(uint32 numThreads)
+    : mFunction(nullptr)
+    , mNumTasks(0)
+    , mJobIndex(0)
+    , mNumActiveWorkers(0)
+    , mShutdown(false)
+    , mNextTask(0)
+{
+    if (numThreads == 0)
+    {
+        numThreads = std::max<uint32>(1, std::thread::hardware_concurrency());
+    }
+
+    // the calling thread is the first one
+    for (uint32 i = 1; i < numThreads; ++i)
+    {
+        mWorkers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShutdown = true;
+    }
+    mWorkAvailable.notify_all();
+
+    for (std::thread& worker : mWorkers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(uint32 numTasks, const TaskFunction& func)
+{
+    if (numTasks == 0)
+    {
+        return;
+    }
+
+    if (mWorkers.empty() || numTasks == 1)
+    {
+        for (uint32 i = 0; i < numTasks; ++i)
+        {
+            func(i, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFunction = &func;
+        mNumTasks = numTasks;
+        mNextTask.store(0);
+        mNumActiveWorkers = (uint32)mWorkers.size();
+        mJobIndex++;
+    }
+    mWorkAvailable.notify_all();
+
+    RunTasks(0);
+
+    // wait for the workers
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWorkFinished.wait(lock, [this] { return mNumActiveWorkers == 0; });
+    mFunction = nullptr;
+}
+
+void ThreadPool::WorkerLoop(uint32 threadIndex)
+{
+    uint32 lastJobIndex = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWorkAvailable.wait(lock, [&] { return mShutdown || mJobIndex != lastJobIndex; });
+
+            if (mShutdown)
+            {
+                return;
+            }
+
+            lastJobIndex = mJobIndex;
+        }
+
+        RunTasks(threadIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            assert(mNumActiveWorkers > 0);
+            if (--mNumActiveWorkers == 0)
+            {
+                mWorkFinished.notify_one();
+            }
+        }
+    }
+}
+
+void ThreadPool::RunTasks(uint32 threadIndex)
+{
+    // tasks are grabbed dynamically, so faster threads take more of them
+    for (;;)
+    {
+        const uint32 task = mNextTask.fetch_add(1);
+        if (task >= mNumTasks)
+        {
+            break;
+        }
+
+        (*mFunction)(task, threadIndex);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+
+/**
+* Fixed set of worker threads executing parallel loops.
+* Each ParallelFor call is a barrier - it returns when all the tasks are finished.
+*/
+class ThreadPool
+{
+public:
+    // task function: (task index, thread index)
+    using TaskFunction = std::function<void(uint32, uint32)>;
+
+    // numThreads includes the calling thread (0 - use all the hardware threads)
+    explicit ThreadPool(uint32 numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    uint32 GetNumThreads() const
+    {
+        return (uint32)mWorkers.size() + 1;
+    }
+
+    // execute 'func' for all the tasks in [0, numTasks) range, the calling thread participates as well
+    // NOTE: must not be called concurrently from multiple threads
+    void ParallelFor(uint32 numTasks, const TaskFunction& func);
+
+private:
+    void WorkerLoop(uint32 threadIndex);
+    void RunTasks(uint32 threadIndex);
+
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mMutex;
+    std::condition_variable mWorkAvailable;
+    std::condition_variable mWorkFinished;
+
+    // current job (guarded by mMutex)
+    const TaskFunction* mFunction;
+    uint32 mNumTasks;
+    uint32 mJobIndex;               // incremented for every ParallelFor call
+    uint32 mNumActiveWorkers;       // workers still processing current job
+    bool mShutdown;
+
+    std::atomic<uint32> mNextTask;
+};
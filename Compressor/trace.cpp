@@ -0,0 +1,181 @@
+#include "trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct TraceEvent
+{
+    const char* name;
+    const char* arg0Name;
+    const char* arg1Name;
+    int64 arg0;
+    int64 arg1;
+    uint64 startTime;
+    uint64 duration;
+};
+
+struct TraceBuffer
+{
+    std::vector<TraceEvent> events;
+    uint64 numRecorded;     // total number of recorded events (ring buffer write position)
+    uint32 threadIndex;     // reported as thread ID
+    bool inUse;             // owned by a running thread
+
+    explicit TraceBuffer(uint32 threadIndex)
+        : numRecorded(0)
+        , threadIndex(threadIndex)
+        , inUse(true)
+    {
+        events.resize(TRACE_BUFFER_CAPACITY);
+    }
+};
+
+const Clock::time_point gEpoch = Clock::now();
+
+// registry of all the thread buffers (never shrinks, so buffers stay valid after threads exit)
+std::mutex gBuffersMutex;
+std::vector<std::unique_ptr<TraceBuffer>> gBuffers;
+
+TraceBuffer* AcquireBuffer()
+{
+    std::lock_guard<std::mutex> lock(gBuffersMutex);
+
+    for (const std::unique_ptr<TraceBuffer>& buffer : gBuffers)
+    {
+        if (!buffer->inUse)
+        {
+            buffer->inUse = true;
+            return buffer.get();
+        }
+    }
+
+    gBuffers.emplace_back(new TraceBuffer((uint32)gBuffers.size()));
+    return gBuffers.back().get();
+}
+
+// releases thread's buffer when the thread exits
+struct ThreadBufferHandle
+{
+    TraceBuffer* buffer = nullptr;
+
+    ~ThreadBufferHandle()
+    {
+        if (buffer)
+        {
+            std::lock_guard<std::mutex> lock(gBuffersMutex);
+            buffer->inUse = false;
+        }
+    }
+};
+
+thread_local ThreadBufferHandle tThreadBuffer;
+
+void WriteEventJson(std::ostream& stream, const TraceEvent& event, uint32 threadIndex)
+{
+    stream << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << threadIndex
+        << ", \"ts\": " << (double)event.startTime / 1000.0
+        << ", \"dur\": " << (double)event.duration / 1000.0;
+
+    if (event.arg0Name)
+    {
+        stream << ", \"args\": {\"" << event.arg0Name << "\": " << event.arg0;
+        if (event.arg1Name)
+        {
+            stream << ", \"" << event.arg1Name << "\": " << event.arg1;
+        }
+        stream << "}";
+    }
+
+    stream << "}";
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+std::atomic<bool> Trace::sEnabled(false);
+
+void Trace::Enable(bool enable)
+{
+    sEnabled.store(enable, std::memory_order_relaxed);
+}
+
+void Trace::Clear()
+{
+    std::lock_guard<std::mutex> lock(gBuffersMutex);
+    for (const std::unique_ptr<TraceBuffer>& buffer : gBuffers)
+    {
+        buffer->numRecorded = 0;
+    }
+}
+
+uint64 Trace::GetTime()
+{
+    return (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - gEpoch).count();
+}
+
+void Trace::Record(const char* name, uint64 startTime, uint64 endTime,
+                   const char* arg0Name, int64 arg0, const char* arg1Name, int64 arg1)
+{
+    TraceBuffer* buffer = tThreadBuffer.buffer;
+    if (!buffer)
+    {
+        buffer = AcquireBuffer();
+        tThreadBuffer.buffer = buffer;
+    }
+
+    TraceEvent& event = buffer->events[buffer->numRecorded % TRACE_BUFFER_CAPACITY];
+    event.name = name;
+    event.arg0Name = arg0Name;
+    event.arg1Name = arg1Name;
+    event.arg0 = arg0;
+    event.arg1 = arg1;
+    event.startTime = startTime;
+    event.duration = endTime - startTime;
+    buffer->numRecorded++;
+}
+
+bool Trace::Save(const std::string& name)
+{
+    std::ofstream file(name);
+    if (!file.good())
+    {
+        std::cout << "Failed to open trace file '" << name << "'" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(gBuffersMutex);
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    bool first = true;
+    for (const std::unique_ptr<TraceBuffer>& buffer : gBuffers)
+    {
+        file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": "
+            << buffer->threadIndex << ", \"args\": {\"name\": \"Thread " << buffer->threadIndex << "\"}}";
+        first = false;
+
+        // only the most recent events survive in the ring buffer
+        const uint64 numEvents = std::min<uint64>(buffer->numRecorded, TRACE_BUFFER_CAPACITY);
+        for (uint64 i = buffer->numRecorded - numEvents; i < buffer->numRecorded; ++i)
+        {
+            file << ",\n";
+            WriteEventJson(file, buffer->events[i % TRACE_BUFFER_CAPACITY], buffer->threadIndex);
+        }
+    }
+
+    file << "\n]}\n";
+    return file.good();
+}
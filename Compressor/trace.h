@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common.h"
+
+#include <string>
+#include <atomic>
+
+
+//////////////////////////////////////////////////////////////////////////
+
+// uncomment to compile out all the trace scopes
+//#define DISABLE_TRACE
+
+// number of events kept per thread (the oldest events are overwritten)
+#define TRACE_BUFFER_CAPACITY           16384
+
+// domain searches for smaller ranges are not traced (there are too many of them)
+#define TRACE_MIN_DOMAIN_SEARCH_SIZE    16
+
+/**
+* Timeline of encoder and decoder work, exported in Chrome trace format
+* (chrome://tracing, ui.perfetto.dev).
+*
+* Every thread records into its own ring buffer, which is registered once
+* (on the first event), so recording an event never takes a lock.
+* Buffers of finished threads are reused by new ones.
+*/
+class Trace
+{
+public:
+    // start/stop recording events (disabled by default)
+    static void Enable(bool enable);
+
+    static bool IsEnabled()
+    {
+        return sEnabled.load(std::memory_order_relaxed);
+    }
+
+    // drop all the recorded events
+    // NOTE: must not be called while other threads are recording
+    static void Clear();
+
+    // save all the recorded events as Chrome trace JSON
+    // NOTE: must not be called while other threads are recording
+    static bool Save(const std::string& name);
+
+    // current time (in nanoseconds since the trace epoch)
+    static uint64 GetTime();
+
+    // record complete event
+    static void Record(const char* name, uint64 startTime, uint64 endTime,
+                       const char* arg0Name, int64 arg0, const char* arg1Name, int64 arg1);
+
+private:
+    static std::atomic<bool> sEnabled;
+};
+
+// Records an event spanning its lifetime
+// NOTE: names must be string literals (only pointers are stored)
+class TraceScope
+{
+public:
+    TraceScope(const char* name, const char* arg0Name = nullptr, int64 arg0 = 0,
+               const char* arg1Name = nullptr, int64 arg1 = 0)
+        : mName(Trace::IsEnabled() ? name : nullptr)
+        , mArg0Name(arg0Name)
+        , mArg1Name(arg1Name)
+        , mArg0(arg0)
+        , mArg1(arg1)
+        , mStartTime(mName ? Trace::GetTime() : 0)
+    { }
+
+    ~TraceScope()
+    {
+        if (mName)
+        {
+            Trace::Record(mName, mStartTime, Trace::GetTime(), mArg0Name, mArg0, mArg1Name, mArg1);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator = (const TraceScope&) = delete;
+
+private:
+    const char* mName;
+    const char* mArg0Name;
+    const char* mArg1Name;
+    int64 mArg0;
+    int64 mArg1;
+    uint64 mStartTime;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifndef DISABLE_TRACE
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SCOPE(...)
+#endif // DISABLE_TRACE
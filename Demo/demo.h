@@ -19,6 +19,16 @@
 #define CHROMA_IMAGE_SIZE_BITS      (IMAGE_SIZE_BITS - CHROMA_SUBSAMPLING)
 #define CHROMA_IMAGE_SIZE           (IMAGE_SIZE >> CHROMA_SUBSAMPLING)
 
+// decode in a single buffer (Gauss-Seidel iteration) - converges faster and saves one image buffer
+#define IN_PLACE_DECODING
+
+// start decoding from an image filled with fixed points of the range blocks' color transforms (instead of black)
+// - saves a few iterations
+#define FIXED_POINT_INITIALIZATION
+
+// decode range blocks with specialized SIMD kernels (see Compressor/decode_kernels.h) - faster, but bigger
+//#define USE_DECODE_KERNELS
+
 // TODO
 #define MIN_RANGE_SIZE              8
 #define MAX_RANGE_SIZE              64
@@ -36,11 +46,15 @@
 
 using uint8 = unsigned char;
 using uint32 = unsigned int;
+using uint64 = unsigned long long;
 using uint16 = unsigned short;
 using int8 = char;
 using int32 = int;
 using int16 = short;
 
+// uses the types above
+#include "../Compressor/domain_bits.h"
+
 //////////////////////////////////////////////////////////////////////////
 
 template<typename T>
@@ -58,20 +72,16 @@ FORCE_INLINE T Max(const T a, const T b)
 class Stream;
 class Image;
 
-struct Domain
-{
-    uint16 x : DOMAIN_LOCATION_BITS;
-    uint16 y : DOMAIN_LOCATION_BITS;
-    uint16 transform : DOMAIN_TRANSFORM_BITS;
-    uint16 offset : DOMAIN_OFFSET_BITS;
-    uint16 scale : DOMAIN_SCALE_BITS;
-};
+// same layout as the compressor's domains (the data files are generated by Compressor::SaveAsSourceFile)
+using Domain = DomainBits;
 
 struct RangeDecompressContext
 {
     uint32 rx0, ry0;
     uint32 rangeSize;
+    uint32 minRangeSize;
     uint32 domainScaling;
+    bool initialize;        // write fixed points of color transforms instead of decoding
     uint32& domainIndex;
     Stream& quadtreeCode;
     const Domain* domains;
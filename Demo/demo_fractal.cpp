@@ -3,14 +3,20 @@
 #include "image.h"
 #include "stream.h"
 
+#ifdef USE_DECODE_KERNELS
+#include "../Compressor/decode_kernels.h"
+#endif // USE_DECODE_KERNELS
+
+#ifndef IN_PLACE_DECODING
 unsigned char tempBuffer[IMAGE_SIZE * IMAGE_SIZE] = { 0 };
+#endif // IN_PLACE_DECODING
+
+// set when any pixel changed noticeably in the current iteration
+bool imageChanged = false;
 
 unsigned char lumaBuffer[IMAGE_SIZE * IMAGE_SIZE] = { 0 };
-unsigned char cbBufferUpsampled[IMAGE_SIZE * IMAGE_SIZE] = { 0 };
-unsigned char crBufferUpsampled[IMAGE_SIZE * IMAGE_SIZE] = { 0 };
-// NOTE: these two below should be smaller, but the empty sections compress better if all have the same size
-unsigned char cbBuffer[IMAGE_SIZE * IMAGE_SIZE] = { 0 }; // downsampled
-unsigned char crBuffer[IMAGE_SIZE * IMAGE_SIZE] = { 0 }; // downsampled
+unsigned char cbBuffer[IMAGE_SIZE * IMAGE_SIZE] = { 0 };
+unsigned char crBuffer[IMAGE_SIZE * IMAGE_SIZE] = { 0 };
 
 // final color image
 unsigned int finalImage[IMAGE_SIZE * IMAGE_SIZE] = { 0 };
@@ -54,7 +60,7 @@ void DecompressRange(const RangeDecompressContext& context)
 {
     // check if this range should be subdivided
     bool subdivide = false;
-    if (context.rangeSize > MIN_RANGE_SIZE)
+    if (context.rangeSize > context.minRangeSize)
     {
         subdivide = context.quadtreeCode.GetBit();
     }
@@ -76,6 +82,49 @@ void DecompressRange(const RangeDecompressContext& context)
     else // !subdivide
     {
         const Domain& domain = context.domains[context.domainIndex++];
+
+#ifdef FIXED_POINT_INITIALIZATION
+        if (context.initialize)
+        {
+            // v = scale * v + offset  =>  v = offset / (1 - scale)
+            const int32 intScale = (int32)domain.scale - (1 << (DOMAIN_SCALE_BITS - 1));
+            const int32 intOffset = ((int32)domain.offset << (DOMAIN_OFFSET_RANGE_BITS - DOMAIN_OFFSET_BITS)) - DOMAIN_OFFSET_RANGE;
+            const int32 denominator = (1 << (DOMAIN_SCALE_BITS - DOMAIN_SCALE_RANGE_BITS)) - intScale;
+            const int32 value = denominator > 0 ? intOffset * (1 << (DOMAIN_SCALE_BITS - DOMAIN_SCALE_RANGE_BITS)) / denominator : 128;
+            const uint8 color = static_cast<uint8>(Max<int32>(0, Min<int32>(255, value)));
+
+            for (uint32 y = 0; y < context.rangeSize; y++)
+            {
+                for (uint32 x = 0; x < context.rangeSize; x++)
+                {
+                    context.destImage.WritePixel(x + context.rx0, y + context.ry0, color);
+                }
+            }
+            return;
+        }
+#endif // FIXED_POINT_INITIALIZATION
+
+#ifdef USE_DECODE_KERNELS
+        // domains wrapping around the image edges are not supported by the kernels
+        const uint32 size = context.srcImage.GetSize();
+        const uint32 domainX = domain.x << context.domainScaling;
+        const uint32 domainY = domain.y << context.domainScaling;
+        const DecodeKernel kernel = GetDecodeKernel(context.rangeSize, domain.transform);
+        if (kernel && domainX + 2 * context.rangeSize <= size && domainY + 2 * context.rangeSize <= size)
+        {
+            const int32 intScale = (int32)domain.scale - (1 << (DOMAIN_SCALE_BITS - 1));
+            const int32 intOffset = ((int32)domain.offset << (DOMAIN_OFFSET_RANGE_BITS - DOMAIN_OFFSET_BITS)) - DOMAIN_OFFSET_RANGE;
+
+            uint64 deltaSum = 0;
+            if (kernel(context.srcImage.mData, context.destImage.mData, size, context.rx0, context.ry0,
+                       domainX, domainY, intScale, intOffset, deltaSum) > 1)
+            {
+                imageChanged = true;
+            }
+            return;
+        }
+#endif // USE_DECODE_KERNELS
+
         for (uint32 y = 0; y < context.rangeSize; y++)
         {
             const uint32 ry = context.ry0 + y;
@@ -94,77 +143,112 @@ void DecompressRange(const RangeDecompressContext& context)
                 const uint32 domainPixelColor = context.srcImage.SampleDomain(dx, dy);
 
                 // transform color
-                context.destImage.WritePixel(x + context.rx0, ry, TransformColor(domain, (uint8)domainPixelColor));
+                const uint8 color = TransformColor(domain, (uint8)domainPixelColor);
+
+                // pixels oscillating by one level (due to rounding) are treated as converged
+                const int32 delta = (int32)color - (int32)context.srcImage.Sample(x + context.rx0, ry);
+                if (delta > 1 || delta < -1)
+                    imageChanged = true;
+
+                context.destImage.WritePixel(x + context.rx0, ry, color);
             }
         }
     }
 }
 
-void Decompress(uint32 size, uint32 domainScaling, const Domain domains[], const uint32 quadTreeCode[], uint8* outputBuffer)
+// single pass through all the range blocks
+void DecompressPass(const Image& src, Image& dest, bool initialize, uint32 size, uint32 domainScaling,
+                    uint32 minRangeSize, uint32 maxRangeSize, const Domain domains[], Stream& quadtreeCode)
 {
+    quadtreeCode.ResetCursor();
+
+    // iterate through root domains
+    uint32 domainIndex = 0;
+
+    RangeDecompressContext context(src, dest, domainIndex, quadtreeCode);
+    context.rangeSize = maxRangeSize;
+    context.minRangeSize = minRangeSize;
+    context.domains = domains;
+    context.domainScaling = domainScaling;
+    context.initialize = initialize;
+
+    for (uint32 ry0 = 0; ry0 < size; ry0 += maxRangeSize)
+    {
+        for (uint32 rx0 = 0; rx0 < size; rx0 += maxRangeSize)
+        {
+            context.rx0 = rx0;
+            context.ry0 = ry0;
+            DecompressRange(context);
+        }
+    }
+}
+
+// NOTE: fractal code is resolution independent - scaling range sizes and domain locations up
+// decodes the image at higher resolution than it was encoded
+void Decompress(uint32 size, uint32 domainScaling, uint32 minRangeSize, uint32 maxRangeSize,
+                const Domain domains[], const uint32 quadTreeCode[], uint8* outputBuffer)
+{
+#ifdef IN_PLACE_DECODING
+    // single buffer - ranges sample pixels already updated in the current iteration
+    Image image = { outputBuffer, size, size - 1 };
+#else
     uint32 currentImage = 0;
     Image tempImages[2] = { { outputBuffer, size, size - 1 }, { tempBuffer, size, size - 1 } };
+#endif // IN_PLACE_DECODING
 
     Stream tmpQuadtreeCode(quadTreeCode);
 
+#ifdef FIXED_POINT_INITIALIZATION
+    // the first iteration reads the output buffer in both modes
+    {
+        Image initialImage = { outputBuffer, size, size - 1 };
+        DecompressPass(initialImage, initialImage, true, size, domainScaling, minRangeSize, maxRangeSize, domains, tmpQuadtreeCode);
+    }
+#endif // FIXED_POINT_INITIALIZATION
+
     for (uint32 i = 0; i < 128; ++i)
     {
+#ifdef IN_PLACE_DECODING
+        const Image& src = image;
+        Image& dest = image;
+#else
         // swap images
         const Image& src = tempImages[currentImage];
         currentImage ^= 1;
         Image& dest = tempImages[currentImage];
-
-        tmpQuadtreeCode.ResetCursor();
-
-        // iterate through root domains
-        uint32 domainIndex = 0;
-
-        RangeDecompressContext context(src, dest, domainIndex, tmpQuadtreeCode);
-        context.rangeSize = MAX_RANGE_SIZE;
-        context.domains = domains;
-        context.domainScaling = domainScaling;  // TODO this depends on image size
-
-        for (uint32 ry0 = 0; ry0 < size; ry0 += MAX_RANGE_SIZE)
-        {
-            for (uint32 rx0 = 0; rx0 < size; rx0 += MAX_RANGE_SIZE)
-            {
-                context.rx0 = rx0;
-                context.ry0 = ry0;
-                DecompressRange(context);
-            }
-        }
+#endif // IN_PLACE_DECODING
+
+        imageChanged = false;
+        DecompressPass(src, dest, false, size, domainScaling, minRangeSize, maxRangeSize, domains, tmpQuadtreeCode);
+
+#ifdef IN_PLACE_DECODING
+        if (!imageChanged)
+            break;
+#else
+        // stop when converged (the result must end up in the output buffer)
+        if (!imageChanged && currentImage == 0)
+            break;
+#endif // IN_PLACE_DECODING
     }
 }
 
 FORCE_INLINE static void Decompress()
 {
     const uint32 lumaDomainScaling = IMAGE_SIZE_BITS > DOMAIN_LOCATION_BITS ? IMAGE_SIZE_BITS - DOMAIN_LOCATION_BITS : 0;
-    Decompress(IMAGE_SIZE, lumaDomainScaling, lumaDomainsData, lumaQuadtreeData, lumaBuffer);
+    Decompress(IMAGE_SIZE, lumaDomainScaling, MIN_RANGE_SIZE, MAX_RANGE_SIZE, lumaDomainsData, lumaQuadtreeData, lumaBuffer);
 
+    // chroma is decoded directly at the luma resolution
     const uint32 chromaDomainScaling = CHROMA_IMAGE_SIZE_BITS > DOMAIN_LOCATION_BITS ? CHROMA_IMAGE_SIZE_BITS - DOMAIN_LOCATION_BITS : 0;
-    Decompress(CHROMA_IMAGE_SIZE, chromaDomainScaling, cbDomainsData, cbQuadtreeData, cbBuffer);
-    Decompress(CHROMA_IMAGE_SIZE, chromaDomainScaling, crDomainsData, crQuadtreeData, crBuffer);
-
-    // upsample chroma
-    {
-        const uint32 chromaSubsampling = 4;
-        for (uint32 y = 0; y < CHROMA_IMAGE_SIZE * chromaSubsampling; ++y)
-        {
-            for (uint32 x = 0; x < CHROMA_IMAGE_SIZE * chromaSubsampling; ++x)
-            {
-                const uint32 srcLoc = CHROMA_IMAGE_SIZE * (y / chromaSubsampling) + (x / chromaSubsampling);
-                const uint32 targetLoc = chromaSubsampling * CHROMA_IMAGE_SIZE * y + x;
-                cbBufferUpsampled[targetLoc] = cbBuffer[srcLoc];
-                crBufferUpsampled[targetLoc] = crBuffer[srcLoc];
-            }
-        }
-    }
+    Decompress(IMAGE_SIZE, chromaDomainScaling + CHROMA_SUBSAMPLING, MIN_RANGE_SIZE << CHROMA_SUBSAMPLING, MAX_RANGE_SIZE << CHROMA_SUBSAMPLING,
+               cbDomainsData, cbQuadtreeData, cbBuffer);
+    Decompress(IMAGE_SIZE, chromaDomainScaling + CHROMA_SUBSAMPLING, MIN_RANGE_SIZE << CHROMA_SUBSAMPLING, MAX_RANGE_SIZE << CHROMA_SUBSAMPLING,
+               crDomainsData, crQuadtreeData, crBuffer);
 
     for (uint32 i = 0; i < IMAGE_SIZE * IMAGE_SIZE; ++i)
     {
         const int32 y = lumaBuffer[i];
-        const int32 cb = cbBufferUpsampled[i];
-        const int32 cr = crBufferUpsampled[i];
+        const int32 cb = cbBuffer[i];
+        const int32 cr = crBuffer[i];
         finalImage[i] = (CONVERT_YCbCr2B(y, cb, cr) << 16) | (CONVERT_YCbCr2G(y, cb, cr) << 8) | (CONVERT_YCbCr2R(y, cb, cr));
         //finalImage[i] = (cb << 16) | (cb << 8) | (cb);
     }